@@ -0,0 +1,201 @@
+/*
+ * File:   bench_common.hpp
+ *
+ * Shared helpers for the benchmarks in this directory: a wall clock timer,
+ * a heap allocation counter and a hardware cache miss counter.
+ *
+ * The allocation counter replaces the global operator new/delete, so this
+ * header must be included by exactly one translation unit per benchmark
+ * executable.
+ *
+ * Cache misses are read through perf_event_open on Linux. When the counter
+ * is unavailable (other platforms, containers, perf_event_paranoid) it is
+ * reported as n/a.
+ */
+
+#ifndef FIMS_BENCH_COMMON_HPP
+#define FIMS_BENCH_COMMON_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace bench {
+
+typedef std::chrono::high_resolution_clock clock;
+
+/**
+ * Number of calls to the global operator new since program start.
+ */
+inline std::atomic<size_t>& allocations() {
+    static std::atomic<size_t> count(0);
+    return count;
+}
+
+/**
+ * Hardware cache miss counter for the calling thread.
+ */
+class cache_miss_counter {
+    int fd_;
+public:
+
+    cache_miss_counter() : fd_(-1) {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof (attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof (attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        this->fd_ = static_cast<int> (syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~cache_miss_counter() {
+#ifdef __linux__
+        if (this->fd_ >= 0) {
+            close(this->fd_);
+        }
+#endif
+    }
+
+    inline bool available() const {
+        return this->fd_ >= 0;
+    }
+
+    inline void start() {
+#ifdef __linux__
+        if (this->fd_ >= 0) {
+            ioctl(this->fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(this->fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /**
+     * Stop counting and return the number of misses since start().
+     */
+    inline long long stop() {
+        long long count = 0;
+#ifdef __linux__
+        if (this->fd_ >= 0) {
+            ioctl(this->fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(this->fd_, &count, sizeof (count)) != sizeof (count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+};
+
+/**
+ * Measurements of one benchmark case, all per call of the measured code.
+ */
+struct result {
+    double ns; //wall time per call
+    double allocations; //heap allocations per call
+    double cache_misses; //cache misses per call, negative when unavailable
+};
+
+/**
+ * Run f once to warm up, then repeats times under the timer, allocation
+ * counter and cache miss counter.
+ */
+template <class F>
+result measure(F f, size_t repeats) {
+    static cache_miss_counter misses;
+    f();
+
+    size_t allocs = allocations().load();
+    misses.start();
+    clock::time_point start = clock::now();
+    for (size_t r = 0; r < repeats; r++) {
+        f();
+    }
+    double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    long long m = misses.stop();
+    allocs = allocations().load() - allocs;
+
+    result ret;
+    ret.ns = ns / static_cast<double> (repeats);
+    ret.allocations = static_cast<double> (allocs) / static_cast<double> (repeats);
+    ret.cache_misses = misses.available() ?
+            static_cast<double> (m) / static_cast<double> (repeats) : -1.0;
+    return ret;
+}
+
+/**
+ * Time f over repeats calls, return ns per element.
+ */
+template <class F>
+double time_ns(F f, size_t n, size_t repeats) {
+    return measure(f, repeats).ns / static_cast<double> (n);
+}
+
+inline void print_header() {
+    std::printf("%-40s %12s %12s %14s %14s\n", "case", "elements", "ns/elem",
+            "allocs/call", "misses/elem");
+}
+
+/**
+ * Print one result normalized by the number of elements per call.
+ */
+inline void print(const char* name, size_t elements, const result& r) {
+    double n = static_cast<double> (elements);
+    if (r.cache_misses >= 0.0) {
+        std::printf("%-40s %12zu %12.3f %14.1f %14.4f\n", name, elements,
+                r.ns / n, r.allocations, r.cache_misses / n);
+    } else {
+        std::printf("%-40s %12zu %12.3f %14.1f %14s\n", name, elements,
+                r.ns / n, r.allocations, "n/a");
+    }
+}
+
+}  // namespace bench
+
+//kept out of line: once inlined into callers, GCC pairs the malloc and
+//free inside with the new and delete expressions and warns
+//-Wmismatched-new-delete
+__attribute__((noinline)) void* operator new(size_t size) {
+    bench::allocations()++;
+    void* p = std::malloc(size > 0 ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+#endif /* FIMS_BENCH_COMMON_HPP */
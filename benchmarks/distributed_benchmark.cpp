@@ -0,0 +1,249 @@
+/*
+ * File:   distributed_benchmark.cpp
+ *
+ * Strong scaling of distributed evaluation in fims_indexing.hpp: a fixed
+ * model is split into blocks of areas, one per rank, and evaluated time
+ * forward with the area totals exchanged after every time step and a
+ * stand-in objective reduced at the end, see population::set_communicator.
+ *
+ * Build and run, ranks as threads of one process (local_group), doubling
+ * from 1 to maxranks:
+ *
+ *   g++ -std=c++17 -O3 -march=native -pthread distributed_benchmark.cpp
+ *   ./a.out [maxranks] [nyears nseasons nages nsexes nareas]
+ *
+ * On one machine this measures the cost of the decomposition and of the
+ * exchanges, and scaling over cores. Across nodes, build with MPI and run
+ * once per rank count:
+ *
+ *   mpicxx -std=c++17 -O3 -march=native -pthread -DFIMS_MPI distributed_benchmark.cpp
+ *   for n in 1 2 4 8; do mpirun -n $n ./a.out 0 [nyears ...]; done
+ *
+ * Before the in-process sweep, two ranks recompute one area after
+ * mark_area_dirty, which only one of them owns, and the exchanged totals
+ * are checked against a single rank.
+ *
+ * Results are milliseconds per evaluation on rank 0, speedup and
+ * efficiency relative to one rank (the first run of the sweep), and bytes
+ * exchanged per rank and evaluation. The objective is printed so runs can
+ * be compared; it may differ in the last digits between rank counts, as
+ * the contributions are added in a different order.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "../fims_indexing.hpp"
+
+struct dimensions {
+    size_t nyears;
+    size_t nseasons;
+    size_t nages;
+    size_t nsexes;
+    size_t nareas;
+};
+
+struct timing {
+    double ms; //per evaluation
+    double objective;
+};
+
+/**
+ * Build the model on one rank and time repeats evaluations.
+ */
+timing run_rank(const dimensions& d, std::shared_ptr<fims::communicator> comm, size_t repeats) {
+    std::vector<double> ages(d.nages);
+    for (size_t a = 0; a < d.nages; a++) {
+        ages[a] = static_cast<double> (a + 1);
+    }
+    std::shared_ptr<const calendar> cal = std::make_shared<const calendar>(d.nyears,
+            d.nseasons, d.nages, index_layout::ragged, ages);
+    std::vector<std::shared_ptr<area> > areas(d.nareas);
+    for (size_t j = 0; j < d.nareas; j++) {
+        areas[j] = std::make_shared<area>(cal);
+    }
+    population pop(cal);
+    pop.set_communicator(comm);
+    pop.initialize_subpopulations(d.nsexes, std::move(areas));
+
+    //stand-in for catch removed from each area, a function of the
+    //exchanged totals and so the same on every rank
+    double removals = 0.0;
+    auto evaluate = [&]() -> double {
+        removals = 0.0;
+        pop.mark_dirty();
+        pop.evaluate_time_forward([&](size_t, size_t) {
+            const std::vector<double>& totals = pop.get_area_totals();
+            for (size_t j = 0; j < totals.size(); j++) {
+                removals += 1e-6 * totals[j];
+            }
+        });
+        double local = 0.0;
+        for (size_t k = 0; k < pop.subpopulation_.size(); k++) {
+            if (pop.is_local(k)) {
+                const derived_quantity_view& v = pop.subpopulation_[k].some_derived_quantities;
+                local += v[v.size() - 1];
+            }
+        }
+        return pop.reduce_sum(local) + removals;
+    };
+
+    timing ret;
+    ret.objective = evaluate();
+    comm->barrier();
+    bench::clock::time_point start = bench::clock::now();
+    for (size_t r = 0; r < repeats; r++) {
+        ret.objective = evaluate();
+    }
+    comm->barrier();
+    ret.ms = std::chrono::duration<double, std::milli>(bench::clock::now() - start).count() /
+            static_cast<double> (repeats);
+    return ret;
+}
+
+void print_header() {
+    std::printf("%8s %12s %10s %10s %14s %20s\n", "ranks", "ms/eval", "speedup",
+            "efficiency", "bytes/eval", "objective");
+}
+
+void print_row(const dimensions& d, size_t nranks, const timing& t, double baseline_ms) {
+    //one allreduce of nareas doubles per time step and one of the objective
+    size_t steps = d.nyears * d.nseasons;
+    double bytes = nranks > 1 ? 8.0 * static_cast<double> (steps * d.nareas + 1) : 0.0;
+    double speedup = baseline_ms / t.ms;
+    std::printf("%8zu %12.3f %10.2f %10.2f %14.0f %20.10e\n", nranks, t.ms, speedup,
+            speedup / static_cast<double> (nranks), bytes, t.objective);
+}
+
+size_t repeats_for(const dimensions& d) {
+    size_t cells = d.nyears * d.nseasons * d.nages * d.nsexes * d.nareas;
+    return std::max<size_t>(3, 200000000 / std::max<size_t>(cells, 1));
+}
+
+void print_dimensions(const dimensions& d) {
+    std::printf("nyears = %zu, nseasons = %zu, nages = %zu, nsexes = %zu, nareas = %zu, partitions = %zu\n",
+            d.nyears, d.nseasons, d.nages, d.nsexes, d.nareas, d.nsexes * d.nareas);
+}
+
+#ifdef FIMS_MPI
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    dimensions d = {30, 4, 20, 2, 512};
+    if (argc >= 7) {
+        d.nyears = std::strtoul(argv[2], NULL, 10);
+        d.nseasons = std::strtoul(argv[3], NULL, 10);
+        d.nages = std::strtoul(argv[4], NULL, 10);
+        d.nsexes = std::strtoul(argv[5], NULL, 10);
+        d.nareas = std::strtoul(argv[6], NULL, 10);
+    }
+    std::shared_ptr<fims::communicator> comm = std::make_shared<fims::mpi_communicator>();
+    timing t = run_rank(d, comm, repeats_for(d));
+    if (comm->rank() == 0) {
+        print_dimensions(d);
+        print_header();
+        //speedup is relative to this run, compare ms/eval across runs
+        print_row(d, comm->size(), t, t.ms);
+    }
+    MPI_Finalize();
+    return 0;
+}
+
+#else
+
+/**
+ * Area totals of every time step after a full evaluation followed by
+ * mark_area_dirty(0), on one rank of a group of comm->size().
+ */
+std::vector<std::vector<double> > partial_dirty_totals(const dimensions& d,
+        std::shared_ptr<fims::communicator> comm) {
+    std::vector<double> ages(d.nages, 1.0);
+    std::shared_ptr<const calendar> cal = std::make_shared<const calendar>(d.nyears,
+            d.nseasons, d.nages, index_layout::ragged, ages);
+    std::vector<std::shared_ptr<area> > areas(d.nareas);
+    for (size_t j = 0; j < d.nareas; j++) {
+        areas[j] = std::make_shared<area>(cal);
+    }
+    population pop(cal);
+    pop.set_communicator(comm);
+    pop.initialize_subpopulations(d.nsexes, std::move(areas));
+    pop.evaluate_time_forward();
+
+    std::vector<std::vector<double> > ret;
+    pop.mark_area_dirty(0, 0);
+    pop.evaluate_time_forward([&](size_t, size_t) {
+        ret.push_back(pop.get_area_totals());
+    });
+    return ret;
+}
+
+/**
+ * Only rank 0 owns area 0, all ranks must still take part in every
+ * exchange and see the same totals as a single rank.
+ */
+bool check_partial_dirty() {
+    const dimensions d = {5, 2, 4, 2, 4};
+    std::vector<std::vector<double> > expected =
+            partial_dirty_totals(d, std::make_shared<fims::serial_communicator>());
+    fims::local_group group(2);
+    std::vector<std::vector<double> > other;
+    std::thread thread([&]() {
+        other = partial_dirty_totals(d, group.rank(1));
+    });
+    std::vector<std::vector<double> > first = partial_dirty_totals(d, group.rank(0));
+    thread.join();
+    return first == expected && other == expected;
+}
+
+int main(int argc, char** argv) {
+    size_t maxranks = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 0;
+    if (maxranks == 0) {
+        maxranks = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    }
+    dimensions d = {30, 4, 20, 2, 512};
+    if (argc >= 7) {
+        d.nyears = std::strtoul(argv[2], NULL, 10);
+        d.nseasons = std::strtoul(argv[3], NULL, 10);
+        d.nages = std::strtoul(argv[4], NULL, 10);
+        d.nsexes = std::strtoul(argv[5], NULL, 10);
+        d.nareas = std::strtoul(argv[6], NULL, 10);
+    }
+    if (!check_partial_dirty()) {
+        std::printf("mark_area_dirty check failed: ranks exchanged different totals\n");
+        return 1;
+    }
+    std::printf("mark_area_dirty check passed\n");
+
+    size_t repeats = repeats_for(d);
+    std::printf("repeats = %zu, hardware threads = %u\n", repeats, std::thread::hardware_concurrency());
+    print_dimensions(d);
+    print_header();
+
+    double baseline_ms = 0.0;
+    for (size_t nranks = 1; nranks <= maxranks; nranks *= 2) {
+        fims::local_group group(nranks);
+        std::vector<timing> results(nranks);
+        std::vector<std::thread> threads;
+        for (size_t r = 1; r < nranks; r++) {
+            threads.push_back(std::thread([&, r]() {
+                results[r] = run_rank(d, group.rank(r), repeats);
+            }));
+        }
+        results[0] = run_rank(d, group.rank(0), repeats);
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        if (nranks == 1) {
+            baseline_ms = results[0].ms;
+        }
+        print_row(d, nranks, results[0], baseline_ms);
+    }
+    return 0;
+}
+
+#endif
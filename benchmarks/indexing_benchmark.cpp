@@ -0,0 +1,315 @@
+/*
+ * File:   indexing_benchmark.cpp
+ *
+ * Benchmarks for the partitioning and time indexing prototype in
+ * fims_indexing.hpp: population::evaulate_subpopulations and
+ * evaluate_time_forward, model_base::get_index, time_age_indexer, batched
+ * replicates, the output sinks and checkpoint snapshots, for fixed and
+ * variable seasons and for the ragged and padded index layouts.
+ *
+ * Build and run:
+ *
+ *   g++ -std=c++17 -O3 -march=native -pthread indexing_benchmark.cpp
+ *   ./a.out                                   # sweep of preset sizes
+ *   ./a.out nyears nseasons nages nsexes nareas [nthreads]
+ *
+ * Variable seasons draw 1 to nseasons seasons per year. Per-call
+ * measurements are normalized by the number of year/season/age elements
+ * touched, see bench_common.hpp.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "../fims_indexing.hpp"
+
+struct dimensions {
+    size_t nyears;
+    size_t nseasons;
+    size_t nages;
+    size_t nsexes;
+    size_t nareas;
+};
+
+/**
+ * Random variable season offsets with 1 to nseasons seasons per year.
+ */
+std::vector<std::vector<double> > variable_seasons(const dimensions& d) {
+    std::default_random_engine generator;
+    std::uniform_int_distribution<size_t> distribution(1, d.nseasons);
+    std::vector<std::vector<double> > season_offsets(d.nyears);
+    for (size_t y = 0; y < d.nyears; y++) {
+        size_t nseasons = distribution(generator);
+        for (size_t s = 0; s < nseasons; s++) {
+            season_offsets[y].push_back((s + 1) / static_cast<double> (nseasons));
+        }
+    }
+    return season_offsets;
+}
+
+/**
+ * Number of year/season/age cells visited by one pass over a model.
+ */
+size_t cells(const model_base& m) {
+    size_t ret = 0;
+    for (size_t y = 0; y < m.nyears_; y++) {
+        ret += m.get_seasons(y) * m.nages_;
+    }
+    return ret;
+}
+
+void bench_get_index(const char* name, model_base& m, size_t repeats) {
+    volatile size_t sink = 0;
+    bench::result r = bench::measure([&]() {
+        size_t acc = 0;
+        for (size_t y = 0; y < m.nyears_; y++) {
+            for (size_t s = 0; s < m.get_seasons(y); s++) {
+                for (size_t a = 0; a < m.nages_; a++) {
+                    acc += m.get_index(y, s, a);
+                }
+            }
+        }
+        sink = sink + acc;
+    }, repeats);
+    bench::print(name, cells(m), r);
+}
+
+/**
+ * Same traversal as bench_get_index through a time_age_indexer, with the
+ * season offset hoisted out of the age loop.
+ */
+template <size_t NSeasons, size_t NAges>
+void bench_indexer(const char* name, const model_base& m, size_t repeats) {
+    volatile size_t sink = 0;
+    const time_age_indexer<NSeasons, NAges> indexer = m.get_indexer<NSeasons, NAges>();
+    bench::result r = bench::measure([&]() {
+        size_t acc = 0;
+        for (size_t y = 0; y < m.nyears_; y++) {
+            for (size_t s = 0; s < indexer.get_seasons(y); s++) {
+                const size_t first = indexer.get_index(y, s, 0);
+                for (size_t a = 0; a < indexer.get_ages(); a++) {
+                    acc += first + a;
+                }
+            }
+        }
+        sink = sink + acc;
+    }, repeats);
+    bench::print(name, cells(m), r);
+}
+
+void bench_population(const char* name, population& pop,
+        const std::vector<std::shared_ptr<area> >& areas,
+        const dimensions& d, size_t nthreads, size_t repeats) {
+    char label[128];
+
+    bench::result r = bench::measure([&]() {
+        pop.initialize_subpopulations(d.nsexes, areas);
+    }, 1);
+    std::snprintf(label, sizeof (label), "%s initialize", name);
+    bench::print(label, d.nsexes * d.nareas, r);
+
+    size_t elements = cells(pop) * d.nsexes * d.nareas;
+    r = bench::measure([&]() {
+        pop.mark_dirty();
+        pop.evaulate_subpopulations();
+    }, repeats);
+    std::snprintf(label, sizeof (label), "%s evaluate", name);
+    bench::print(label, elements, r);
+
+    //one area's parameters changed from the last ten years on, normalized
+    //by the full model size so it compares with the full evaluation
+    pop.reset_stats();
+    r = bench::measure([&]() {
+        pop.mark_area_dirty(0, d.nyears > 10 ? d.nyears - 10 : 0);
+        pop.evaulate_subpopulations();
+    }, repeats);
+    std::snprintf(label, sizeof (label), "%s evaluate 1 area dirty", name);
+    bench::print(label, elements, r);
+    std::printf("%-40s %11.1f%%\n", "  skipped", 100.0 * pop.stats_.skipped /
+            static_cast<double> (pop.stats_.skipped + pop.stats_.evaluated));
+
+    r = bench::measure([&]() {
+        pop.mark_dirty();
+        pop.evaluate_time_forward();
+    }, repeats);
+    std::snprintf(label, sizeof (label), "%s time forward", name);
+    bench::print(label, elements, r);
+
+    //output discarded by the OS so only formatting and buffering is timed
+    size_t output_repeats = std::max<size_t>(1, repeats / 100);
+    std::ofstream null_stream("/dev/null");
+    fims::text_sink text(null_stream);
+    r = bench::measure([&]() {
+        pop.finalize(text);
+    }, output_repeats);
+    std::snprintf(label, sizeof (label), "%s finalize text", name);
+    bench::print(label, elements, r);
+
+    fims::binary_sink binary("/dev/null");
+    r = bench::measure([&]() {
+        pop.finalize(binary);
+    }, output_repeats);
+    std::snprintf(label, sizeof (label), "%s finalize binary", name);
+    bench::print(label, elements, r);
+
+    //checkpoints go to the working directory and are removed afterwards
+    const char* snapshot_path = "indexing_benchmark.snapshot";
+    r = bench::measure([&]() {
+        pop.write_snapshot(snapshot_path);
+    }, output_repeats);
+    std::snprintf(label, sizeof (label), "%s snapshot write", name);
+    bench::print(label, elements, r);
+
+    fims::async_snapshot_writer writer;
+    r = bench::measure([&]() {
+        pop.write_snapshot(writer, snapshot_path);
+    }, output_repeats);
+    writer.wait();
+    std::snprintf(label, sizeof (label), "%s snapshot write async", name);
+    bench::print(label, elements, r);
+
+    population restored(pop.calendar_);
+    r = bench::measure([&]() {
+        restored.restore(std::make_shared<const fims::mapped_snapshot>(snapshot_path), areas);
+    }, output_repeats);
+    std::snprintf(label, sizeof (label), "%s snapshot restore", name);
+    bench::print(label, elements, r);
+    std::remove(snapshot_path);
+
+    if (nthreads > 1) {
+        pop.set_threads(nthreads);
+        r = bench::measure([&]() {
+            pop.mark_dirty();
+            pop.evaulate_subpopulations();
+        }, repeats);
+        std::snprintf(label, sizeof (label), "%s evaluate x%zu", name, nthreads);
+        bench::print(label, elements, r);
+        r = bench::measure([&]() {
+            pop.mark_dirty();
+            pop.evaluate_time_forward();
+        }, repeats);
+        std::snprintf(label, sizeof (label), "%s time forward x%zu", name, nthreads);
+        bench::print(label, elements, r);
+        pop.set_threads(1);
+
+        //a fresh population so the derived quantities are first touched
+        //by their pinned home threads
+        std::vector<int> cpus(nthreads);
+        for (size_t t = 0; t < nthreads; t++) {
+            cpus[t] = static_cast<int> (t);
+        }
+        population pinned(pop.calendar_);
+        pinned.set_affinity(cpus);
+        pinned.initialize_subpopulations(d.nsexes, areas);
+        r = bench::measure([&]() {
+            pinned.mark_dirty();
+            pinned.evaulate_subpopulations();
+        }, repeats);
+        std::snprintf(label, sizeof (label), "%s evaluate x%zu pinned", name, nthreads);
+        bench::print(label, elements, r);
+    }
+}
+
+/**
+ * Batched replicates: one population evaluating nreplicates parameter sets
+ * in lockstep, normalized per cell and replicate.
+ */
+void bench_replicates(const dimensions& d, const std::vector<std::shared_ptr<area> >& areas,
+        size_t nreplicates, size_t repeats) {
+    char label[128];
+    population pop(d.nyears, d.nseasons, d.nages, std::vector<double>(d.nages, 1.0));
+    pop.set_replicates(nreplicates);
+    pop.initialize_subpopulations(d.nsexes, areas);
+    std::vector<double> parameters(nreplicates);
+    for (size_t r = 0; r < nreplicates; r++) {
+        parameters[r] = 1.0 + 0.01 * r;
+    }
+    pop.set_replicate_parameters(parameters);
+
+    bench::result r = bench::measure([&]() {
+        pop.mark_dirty();
+        pop.evaulate_subpopulations();
+    }, std::max<size_t>(1, repeats / nreplicates));
+    std::snprintf(label, sizeof (label), "fixed evaluate %zu replicates", nreplicates);
+    bench::print(label, cells(pop) * d.nsexes * d.nareas * nreplicates, r);
+}
+
+void run(const dimensions& d, size_t nthreads) {
+    std::printf("\nnyears %zu, nseasons %zu, nages %zu, nsexes %zu, nareas %zu\n",
+            d.nyears, d.nseasons, d.nages, d.nsexes, d.nareas);
+    bench::print_header();
+
+    size_t total = d.nyears * d.nseasons * d.nages * d.nsexes * d.nareas;
+    size_t repeats = std::max<size_t>(3, 20000000 / std::max<size_t>(total, 1));
+
+    std::vector<double> ages(d.nages);
+    for (size_t a = 0; a < d.nages; a++) {
+        ages[a] = static_cast<double> (a + 1);
+    }
+    std::vector<std::shared_ptr<area> > areas;
+    for (size_t i = 0; i < d.nareas; i++) {
+        areas.push_back(std::make_shared<area>(d.nyears, d.nseasons, d.nages));
+    }
+    std::vector<std::vector<double> > season_offsets = variable_seasons(d);
+
+    population fixed(d.nyears, d.nseasons, d.nages, ages);
+    population ragged(d.nyears, season_offsets, d.nages);
+    population padded(d.nyears, season_offsets, d.nages);
+    padded.set_index_layout(index_layout::padded);
+
+    bench_get_index("get_index fixed", fixed, repeats * d.nsexes * d.nareas);
+    bench_get_index("get_index variable ragged", ragged, repeats * d.nsexes * d.nareas);
+    bench_get_index("get_index variable padded", padded, repeats * d.nsexes * d.nareas);
+    bench_indexer<0, 0>("indexer fixed", fixed, repeats * d.nsexes * d.nareas);
+    if (d.nseasons == 4) {
+        bench_indexer<4, 0>("indexer fixed <4 seasons>", fixed, repeats * d.nsexes * d.nareas);
+    }
+    bench_indexer<0, 0>("indexer variable ragged", ragged, repeats * d.nsexes * d.nareas);
+
+    bench_population("fixed", fixed, areas, d, nthreads, repeats);
+    bench_population("variable ragged", ragged, areas, d, nthreads, repeats);
+    bench_population("variable padded", padded, areas, d, nthreads, repeats);
+
+    const size_t replicates[] = {1, 8, 32};
+    for (size_t i = 0; i < sizeof (replicates) / sizeof (replicates[0]); i++) {
+        bench_replicates(d, areas, replicates[i], repeats);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t nthreads = std::thread::hardware_concurrency();
+
+    if (argc >= 6) {
+        dimensions d;
+        d.nyears = std::strtoul(argv[1], NULL, 10);
+        d.nseasons = std::strtoul(argv[2], NULL, 10);
+        d.nages = std::strtoul(argv[3], NULL, 10);
+        d.nsexes = std::strtoul(argv[4], NULL, 10);
+        d.nareas = std::strtoul(argv[5], NULL, 10);
+        if (argc >= 7) {
+            nthreads = std::strtoul(argv[6], NULL, 10);
+        }
+        run(d, nthreads);
+        FIMS_INSTRUMENTATION_REPORT(std::clog);
+        return 0;
+    }
+
+    //from the fims_indexing.cpp example up to production sized spatial models
+    const dimensions sweep[] = {
+        {30, 4, 8, 2, 3},
+        {50, 4, 20, 2, 10},
+        {100, 4, 40, 2, 25},
+        {100, 12, 40, 2, 50}
+    };
+    for (size_t i = 0; i < sizeof (sweep) / sizeof (sweep[0]); i++) {
+        run(sweep[i], nthreads);
+    }
+    FIMS_INSTRUMENTATION_REPORT(std::clog);
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * File:   lgamma_benchmark.cpp
+ *
+ * Accuracy and throughput of the log gamma implementations in
+ * fims_math.hpp, measured against std::lgamma.
+ *
+ * Build with the target instruction set enabled, e.g.
+ *
+ *   g++ -std=c++17 -O3 -march=native -DSTD_LIB lgamma_benchmark.cpp
+ *
+ * Accuracy is the max relative error over log-uniform arguments in
+ * (1e-3, 1e6], except where |lgamma(x)| < 1 (near the roots at 1 and 2),
+ * where the absolute error is reported instead. Throughput is ns/element
+ * over the same arguments.
+ *
+ * Results on an x86-64 AVX-512 machine, n = 200000, -O3 -march=native:
+ *
+ *   function                 max rel err   max abs err (|lgamma|<1)   ns/elem
+ *   std::lgamma              reference     reference                  24.8
+ *   fims::lgamma             1.6e-14       5.6e-16                    28.5
+ *   lgamma_nothrow<T>        5.6e-15       6.5e-15                    25.0
+ *   lgamma_nothrow (batch)   7.0e-15       7.4e-15                     6.2
+ *   fims::LogGammaLanczos    4.1e-13       6.4e-14                    20.5
+ *   fims::LogGammaSeries     8.6e+16       1.3                        11.6
+ *
+ * LogGammaSeries truncates Stirling's series after four terms and diverges
+ * for small arguments, which is where its error comes from.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "../fims_math.hpp"
+
+struct accuracy {
+    double max_rel;
+    double max_abs;
+};
+
+accuracy measure(const std::vector<double>& x, const std::vector<double>& y) {
+    accuracy ret = {0.0, 0.0};
+    for (size_t i = 0; i < x.size(); i++) {
+        double ref = std::lgamma(x[i]);
+        double err = std::fabs(y[i] - ref);
+        if (std::fabs(ref) < 1.0) {
+            ret.max_abs = std::max(ret.max_abs, err);
+        } else {
+            ret.max_rel = std::max(ret.max_rel, err / std::fabs(ref));
+        }
+    }
+    return ret;
+}
+
+template <class F>
+void run(const char* name, const std::vector<double>& x, std::vector<double>& y,
+        size_t repeats, F f) {
+    double ns = bench::time_ns([&]() {
+        f(x, y);
+    }, x.size(), repeats);
+    accuracy a = measure(x, y);
+    std::printf("%-24s %12.3g %26.3g %10.3f\n", name, a.max_rel, a.max_abs, ns);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 100000;
+    size_t repeats = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 20;
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> exponent(-3.0, 6.0);
+    std::vector<double> x(n), y(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = std::pow(10.0, exponent(generator));
+    }
+
+    std::printf("n = %zu, repeats = %zu\n\n", n, repeats);
+    std::printf("%-24s %12s %26s %10s\n", "function", "max rel err",
+            "max abs err (|lgamma|<1)", "ns/elem");
+
+    run("std::lgamma", x, y, repeats, [](const std::vector<double>& x, std::vector<double>& y) {
+        for (size_t i = 0; i < x.size(); i++) {
+            y[i] = std::lgamma(x[i]);
+        }
+    });
+    run("fims::lgamma", x, y, repeats, [](const std::vector<double>& x, std::vector<double>& y) {
+        for (size_t i = 0; i < x.size(); i++) {
+            y[i] = fims::lgamma(x[i]);
+        }
+    });
+    run("lgamma_nothrow<T>", x, y, repeats, [](const std::vector<double>& x, std::vector<double>& y) {
+        for (size_t i = 0; i < x.size(); i++) {
+            y[i] = fims::lgamma_nothrow<double>(x[i]);
+        }
+    });
+    run("lgamma_nothrow (batch)", x, y, repeats, [](const std::vector<double>& x, std::vector<double>& y) {
+        fims::lgamma_nothrow(x.data(), y.data(), x.size());
+    });
+    run("fims::LogGammaLanczos", x, y, repeats, [](const std::vector<double>& x, std::vector<double>& y) {
+        for (size_t i = 0; i < x.size(); i++) {
+            y[i] = fims::LogGammaLanczos(x[i]);
+        }
+    });
+    run("fims::LogGammaSeries", x, y, repeats, [](const std::vector<double>& x, std::vector<double>& y) {
+        for (size_t i = 0; i < x.size(); i++) {
+            y[i] = fims::LogGammaSeries(x[i]);
+        }
+    });
+
+    return 0;
+}
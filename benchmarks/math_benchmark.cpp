@@ -0,0 +1,223 @@
+/*
+ * File:   math_benchmark.cpp
+ *
+ * Throughput, allocations and cache misses for each function in
+ * fims_math.hpp, evaluated over n elements.
+ *
+ * Build and run:
+ *
+ *   g++ -std=c++17 -O3 -march=native -pthread -DSTD_LIB math_benchmark.cpp
+ *   ./a.out [n] [ncategories]
+ *
+ * ncategories is the number of age or length bins per multinomial
+ * observation. Results are normalized per element, see bench_common.hpp.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "../fims_math.hpp"
+#include "../fims_thread_pool.hpp"
+
+volatile double sink = 0.0;
+
+/**
+ * Benchmark a scalar function applied to each of the n inputs.
+ */
+template <class F>
+void scalar_case(const char* name, const std::vector<double>& x, size_t repeats, F f) {
+    bench::result r = bench::measure([&]() {
+        double acc = 0.0;
+        for (size_t i = 0; i < x.size(); i++) {
+            acc += f(x[i]);
+        }
+        sink = sink + acc;
+    }, repeats);
+    bench::print(name, x.size(), r);
+}
+
+/**
+ * Benchmark a call that processes all n elements at once.
+ */
+template <class F>
+void batch_case(const char* name, size_t n, size_t repeats, F f) {
+    bench::result r = bench::measure(f, repeats);
+    bench::print(name, n, r);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 100000;
+    size_t ncategories = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 40;
+    size_t repeats = std::max<size_t>(3, 50000000 / std::max<size_t>(n, 1));
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> real(-5.0, 5.0);
+    std::uniform_real_distribution<double> positive(0.01, 30.0);
+    std::uniform_real_distribution<double> unit(0.001, 0.999);
+    std::uniform_int_distribution<int> counts(0, 50);
+
+    std::vector<double> xr(n), xp(n), xu(n), xc(n), mean(n), out(n);
+    std::vector<std::vector<double> > grad(3, std::vector<double>(n));
+    for (size_t i = 0; i < n; i++) {
+        xr[i] = real(generator);
+        xp[i] = positive(generator);
+        xu[i] = unit(generator);
+        xc[i] = static_cast<double> (counts(generator));
+        mean[i] = xr[i] + 0.1 * real(generator);
+    }
+
+    std::printf("n = %zu, repeats = %zu, multinomial categories = %zu\n\n", n, repeats, ncategories);
+    bench::print_header();
+
+    scalar_case("exp", xr, repeats, [](double x) {
+        return fims::exp(x);
+    });
+    scalar_case("log", xp, repeats, [](double x) {
+        return fims::log(x);
+    });
+    scalar_case("logistic", xp, repeats, [](double x) {
+        return fims::logistic(6.0, 0.8, x);
+    });
+    batch_case("logistic (batch)", n, repeats, [&]() {
+        fims::logistic(6.0, 0.8, xp.data(), out.data(), n);
+    });
+    scalar_case("logit", xu, repeats, [](double x) {
+        return fims::logit(0.0, 1.0, x);
+    });
+    batch_case("logit (batch)", n, repeats, [&]() {
+        fims::logit(0.0, 1.0, xu.data(), out.data(), n);
+    });
+    scalar_case("inv_logit", xr, repeats, [](double x) {
+        return fims::inv_logit(0.0, 1.0, x);
+    });
+    batch_case("inv_logit (batch)", n, repeats, [&]() {
+        fims::inv_logit(0.0, 1.0, xr.data(), out.data(), n);
+    });
+    scalar_case("double_logistic", xp, repeats, [](double x) {
+        return fims::double_logistic(6.0, 0.8, 18.0, 0.4, x);
+    });
+    batch_case("double_logistic (batch)", n, repeats, [&]() {
+        fims::double_logistic(6.0, 0.8, 18.0, 0.4, xp.data(), out.data(), n);
+    });
+    batch_case("exp_grad (batch)", n, repeats, [&]() {
+        fims::exp_grad(xr.data(), out.data(), grad[0].data(), n);
+    });
+    batch_case("logistic_grad (batch)", n, repeats, [&]() {
+        fims::logistic_grad(6.0, 0.8, xp.data(), out.data(), grad[0].data(),
+                grad[1].data(), grad[2].data(), n);
+    });
+    scalar_case("ad_fabs", xr, repeats, [](double x) {
+        return fims::ad_fabs(x);
+    });
+    scalar_case("ad_min", xr, repeats, [](double x) {
+        return fims::ad_min(x, 1.0);
+    });
+    scalar_case("ad_max", xr, repeats, [](double x) {
+        return fims::ad_max(x, 1.0);
+    });
+    batch_case("ad_min (batch)", n, repeats, [&]() {
+        fims::ad_min(xr.data(), 1.0, out.data(), n);
+    });
+    batch_case("ad_clamp (batch)", n, repeats, [&]() {
+        fims::ad_clamp(xr.data(), 0.0, 1.0, out.data(), n);
+    });
+    scalar_case("dnorm", xr, repeats, [](double x) {
+        return fims::dnorm(x, 0.5, 2.0);
+    });
+    scalar_case("dnorm (log)", xr, repeats, [](double x) {
+        return fims::dnorm(x, 0.5, 2.0, true);
+    });
+    batch_case("dnorm_nll", n, repeats, [&]() {
+        sink = sink + fims::dnorm_nll(xr.data(), mean.data(), 2.0, n);
+    });
+    scalar_case("dlnorm", xp, repeats, [](double x) {
+        return fims::dlnorm(x, 1.0, 0.5);
+    });
+    scalar_case("dlnorm (log)", xp, repeats, [](double x) {
+        return fims::dlnorm(x, 1.0, 0.5, true);
+    });
+    batch_case("dlnorm_nll", n, repeats, [&]() {
+        sink = sink + fims::dlnorm_nll(xp.data(), mean.data(), 0.5, n);
+    });
+    scalar_case("gamma", xp, repeats, [](double x) {
+        return fims::gamma(x);
+    });
+    scalar_case("lgamma", xp, repeats, [](double x) {
+        return fims::lgamma(x);
+    });
+    scalar_case("lgamma_nothrow", xp, repeats, [](double x) {
+        return fims::lgamma_nothrow<double>(x);
+    });
+    batch_case("lgamma_nothrow (batch)", n, repeats, [&]() {
+        fims::lgamma_nothrow(xp.data(), out.data(), n);
+    });
+    scalar_case("lgamma_count", xc, repeats, [](double x) {
+        return fims::lgamma_count(x + 1.0);
+    });
+    scalar_case("LogGammaLanczos", xp, repeats, [](double x) {
+        return fims::LogGammaLanczos(x);
+    });
+    scalar_case("LogGammaSeries", xp, repeats, [](double x) {
+        return fims::LogGammaSeries(x);
+    });
+    batch_case("lgamma (vector)", n, repeats, [&]() {
+        sink = sink + fims::lgamma(xp)[0];
+    });
+    batch_case("sum", n, repeats, [&]() {
+        sink = sink + fims::sum(xr);
+    });
+    batch_case("sum_lanes", n, repeats, [&]() {
+        sink = sink + fims::sum_lanes(xr.data(), n);
+    });
+    batch_case("sum_kahan", n, repeats, [&]() {
+        sink = sink + fims::sum_kahan(xr.data(), n);
+    });
+    batch_case("sum_pairwise", n, repeats, [&]() {
+        sink = sink + fims::sum_pairwise(xr.data(), n);
+    });
+    fims::thread_pool pool(std::max<unsigned>(1, std::thread::hardware_concurrency()));
+    batch_case("parallel_sum (pairwise)", n, repeats, [&]() {
+        sink = sink + fims::parallel_sum<fims::pairwise_summation>(pool, xr.data(), n);
+    });
+    batch_case("dnorm_nll (kahan)", n, repeats, [&]() {
+        sink = sink + fims::dnorm_nll<double, fims::kahan_summation>(xr.data(), mean.data(), 2.0, n);
+    });
+
+    //multinomial over n / ncategories observations of ncategories bins
+    size_t nobs = n / ncategories;
+    std::vector<std::vector<double> > x(nobs), p(nobs);
+    std::vector<double> constant(nobs);
+    for (size_t o = 0; o < nobs; o++) {
+        x[o].assign(xc.begin() + o * ncategories, xc.begin() + (o + 1) * ncategories);
+        p[o].assign(xu.begin() + o * ncategories, xu.begin() + (o + 1) * ncategories);
+        constant[o] = fims::dmultinom_constant(x[o].data(), ncategories);
+    }
+    batch_case("dmultinom (vector)", nobs * ncategories, repeats, [&]() {
+        double acc = 0.0;
+        for (size_t o = 0; o < nobs; o++) {
+            acc += fims::dmultinom(x[o], p[o], true);
+        }
+        sink = sink + acc;
+    });
+    batch_case("dmultinom_grad", nobs * ncategories, repeats, [&]() {
+        double acc = 0.0;
+        for (size_t o = 0; o < nobs; o++) {
+            acc += fims::dmultinom_grad(x[o].data(), p[o].data(), ncategories,
+                    grad[0].data() + o * ncategories);
+        }
+        sink = sink + acc;
+    });
+    batch_case("dmultinom_cached", nobs * ncategories, repeats, [&]() {
+        double acc = 0.0;
+        for (size_t o = 0; o < nobs; o++) {
+            acc += fims::dmultinom_cached(x[o].data(), p[o].data(), ncategories, constant[o], true);
+        }
+        sink = sink + acc;
+    });
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * File:   selectivity_benchmark.cpp
+ *
+ * Micro-benchmark comparing the batch selectivity kernels in fims_math.hpp
+ * against a loop over the scalar functions.
+ *
+ * Build with the target instruction set enabled, e.g.
+ *
+ *   g++ -std=c++17 -O3 -march=native -DSTD_LIB selectivity_benchmark.cpp
+ *
+ * Each kernel is reported in ns/element for the scalar loop and the batch
+ * call, along with the speedup and the max relative difference.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "../fims_math.hpp"
+
+double max_rel_diff(const std::vector<double>& a, const std::vector<double>& b) {
+    double ret = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double d = std::fabs(a[i] - b[i]) / std::max(std::fabs(b[i]), 1e-300);
+        ret = std::max(ret, d);
+    }
+    return ret;
+}
+
+void report(const char* name, double scalar_ns, double batch_ns, double diff) {
+    std::printf("%-16s scalar %8.3f ns/elem   batch %8.3f ns/elem   speedup %5.2fx   max rel diff %.3g\n",
+            name, scalar_ns, batch_ns, scalar_ns / batch_ns, diff);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 4096;
+    size_t repeats = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 2000;
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> ages(0.0, 30.0);
+    std::uniform_real_distribution<double> bounded(0.001, 0.999);
+    std::uniform_real_distribution<double> real(-8.0, 8.0);
+
+    std::vector<double> x(n), xb(n), xr(n), scalar(n), batch(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = ages(generator);
+        xb[i] = bounded(generator);
+        xr[i] = real(generator);
+    }
+
+    std::printf("n = %zu, repeats = %zu\n\n", n, repeats);
+
+    const double median = 6.0;
+    const double slope = 0.8;
+    double s = bench::time_ns([&]() {
+        for (size_t i = 0; i < n; i++) {
+            scalar[i] = fims::logistic(median, slope, x[i]);
+        }
+    }, n, repeats);
+    double b = bench::time_ns([&]() {
+        fims::logistic(median, slope, x.data(), batch.data(), n);
+    }, n, repeats);
+    report("logistic", s, b, max_rel_diff(batch, scalar));
+
+    const double median_desc = 18.0;
+    const double slope_desc = 0.4;
+    s = bench::time_ns([&]() {
+        for (size_t i = 0; i < n; i++) {
+            scalar[i] = fims::double_logistic(median, slope, median_desc, slope_desc, x[i]);
+        }
+    }, n, repeats);
+    b = bench::time_ns([&]() {
+        fims::double_logistic(median, slope, median_desc, slope_desc, x.data(), batch.data(), n);
+    }, n, repeats);
+    report("double_logistic", s, b, max_rel_diff(batch, scalar));
+
+    const double lo = 0.0;
+    const double hi = 1.0;
+    s = bench::time_ns([&]() {
+        for (size_t i = 0; i < n; i++) {
+            scalar[i] = fims::logit(lo, hi, xb[i]);
+        }
+    }, n, repeats);
+    b = bench::time_ns([&]() {
+        fims::logit(lo, hi, xb.data(), batch.data(), n);
+    }, n, repeats);
+    report("logit", s, b, max_rel_diff(batch, scalar));
+
+    s = bench::time_ns([&]() {
+        for (size_t i = 0; i < n; i++) {
+            scalar[i] = fims::inv_logit(lo, hi, xr[i]);
+        }
+    }, n, repeats);
+    b = bench::time_ns([&]() {
+        fims::inv_logit(lo, hi, xr.data(), batch.data(), n);
+    }, n, repeats);
+    report("inv_logit", s, b, max_rel_diff(batch, scalar));
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * File:   startup_benchmark.cpp
+ *
+ * Model construction time for the prototype in fims_indexing.hpp: building
+ * calendars, areas and populations and partitioning them into
+ * subpopulations, for models with up to thousands of partitions. Nothing
+ * here is evaluated, the numbers track setup cost only.
+ *
+ * Build and run:
+ *
+ *   g++ -std=c++17 -O3 -march=native -pthread startup_benchmark.cpp
+ *   ./a.out                             # sweep of partition counts
+ *   ./a.out nyears nseasons nages nsexes nareas
+ *
+ * Results are per partition (per year for the calendars), along with the
+ * total milliseconds per build, see bench_common.hpp.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "../fims_indexing.hpp"
+
+struct dimensions {
+    size_t nyears;
+    size_t nseasons;
+    size_t nages;
+    size_t nsexes;
+    size_t nareas;
+};
+
+void print_case(const char* name, size_t elements, const bench::result& r) {
+    bench::print(name, elements, r);
+    std::printf("%-40s %12.3f ms/build\n", "", r.ns * 1e-6);
+}
+
+void run(const dimensions& d) {
+    size_t npartitions = d.nsexes * d.nareas;
+    size_t repeats = std::max<size_t>(3, 20000 / std::max<size_t>(npartitions, 1));
+    std::printf("\nnyears = %zu, nseasons = %zu, nages = %zu, nsexes = %zu, nareas = %zu, partitions = %zu\n",
+            d.nyears, d.nseasons, d.nages, d.nsexes, d.nareas, npartitions);
+    bench::print_header();
+
+    std::default_random_engine generator;
+    std::uniform_int_distribution<size_t> distribution(1, d.nseasons);
+    std::vector<std::vector<double> > season_offsets(d.nyears);
+    std::vector<size_t> nseasons(d.nyears);
+    std::vector<double> flat_offsets;
+    for (size_t y = 0; y < d.nyears; y++) {
+        nseasons[y] = distribution(generator);
+        for (size_t s = 0; s < nseasons[y]; s++) {
+            season_offsets[y].push_back((s + 1) / static_cast<double> (nseasons[y]));
+        }
+        flat_offsets.insert(flat_offsets.end(), season_offsets[y].begin(), season_offsets[y].end());
+    }
+    std::vector<double> ages(d.nages);
+    for (size_t a = 0; a < d.nages; a++) {
+        ages[a] = static_cast<double> (a + 1);
+    }
+
+    bench::result r = bench::measure([&]() {
+        calendar cal(d.nyears, d.nseasons, d.nages, index_layout::ragged, ages);
+    }, repeats);
+    print_case("calendar fixed", d.nyears, r);
+
+    r = bench::measure([&]() {
+        calendar cal(d.nyears, season_offsets, d.nages);
+    }, repeats);
+    print_case("calendar variable nested", d.nyears, r);
+
+    //copies made outside the timed region are not counted, the moves are
+    std::vector<std::vector<size_t> > nseasons_copies(repeats + 1, nseasons);
+    std::vector<std::vector<double> > offset_copies(repeats + 1, flat_offsets);
+    size_t next = 0;
+    r = bench::measure([&]() {
+        calendar cal(std::move(nseasons_copies[next]), std::move(offset_copies[next]), d.nages);
+        next++;
+    }, repeats);
+    print_case("calendar variable flat (moved)", d.nyears, r);
+
+    std::shared_ptr<const calendar> cal = std::make_shared<const calendar>(d.nyears,
+            d.nseasons, d.nages, index_layout::ragged, ages);
+    r = bench::measure([&]() {
+        std::vector<std::shared_ptr<area> > areas(d.nareas);
+        for (size_t i = 0; i < d.nareas; i++) {
+            areas[i] = std::make_shared<area>(cal);
+        }
+    }, repeats);
+    print_case("areas (shared calendar)", d.nareas, r);
+
+    std::vector<std::shared_ptr<area> > areas(d.nareas);
+    for (size_t i = 0; i < d.nareas; i++) {
+        areas[i] = std::make_shared<area>(cal);
+    }
+
+    r = bench::measure([&]() {
+        population pop(cal);
+        pop.initialize_subpopulations(d.nsexes, areas);
+    }, repeats);
+    print_case("population build", npartitions, r);
+
+    //rebuilding an existing population reuses its arena
+    population pop(cal);
+    r = bench::measure([&]() {
+        pop.initialize_subpopulations(d.nsexes, areas);
+    }, repeats);
+    print_case("population rebuild", npartitions, r);
+
+    r = bench::measure([&]() {
+        population fixed(d.nyears, d.nseasons, d.nages, ages);
+        fixed.initialize_subpopulations(d.nsexes, areas);
+    }, repeats);
+    print_case("population build (own calendar)", npartitions, r);
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 6) {
+        dimensions d;
+        d.nyears = std::strtoul(argv[1], NULL, 10);
+        d.nseasons = std::strtoul(argv[2], NULL, 10);
+        d.nages = std::strtoul(argv[3], NULL, 10);
+        d.nsexes = std::strtoul(argv[4], NULL, 10);
+        d.nareas = std::strtoul(argv[5], NULL, 10);
+        run(d);
+        return 0;
+    }
+
+    const dimensions presets[] = {
+        {30, 4, 20, 2, 10},
+        {30, 4, 20, 2, 100},
+        {30, 4, 20, 2, 1000},
+        {30, 4, 20, 2, 2500}
+    };
+    for (size_t i = 0; i < sizeof (presets) / sizeof (presets[0]); i++) {
+        run(presets[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*! \file fims_arena.hpp
+ */
+
+/*
+ * File:   fims_arena.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * A monotonic arena for model objects and derived quantity buffers that
+ * are created and destroyed together, plus a standard allocator adapter so
+ * containers can draw from it.
+ *
+ */
+#ifndef FIMS_ARENA_HPP
+#define FIMS_ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace fims {
+
+/**
+ * @brief Bump allocator with a single bulk release.
+ *
+ * Memory is carved from large blocks and individual deallocations are
+ * no-ops. reset() releases everything at once and keeps the memory: if the
+ * arena had to grow, its blocks are merged into one block of the combined
+ * size, so rebuilding the same objects after a reset does not touch the
+ * heap.
+ *
+ * Objects allocated from the arena must be destroyed before reset() or
+ * the arena's destruction.
+ */
+class arena {
+
+    struct block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<block> blocks_;
+    size_t current_; //block being carved
+    size_t offset_; //bytes used in the current block
+    size_t block_size_; //minimum size of a new block
+    size_t used_; //bytes handed out since the last reset, including padding
+
+    void add_block(size_t size) {
+        size = std::max(size, this->block_size_);
+        //64 byte alignment for every block so cache line requests are cheap
+        size = (size + 63) / 64 * 64;
+        char* p = static_cast<char*> (std::aligned_alloc(64, size));
+        if (p == NULL) {
+            throw std::bad_alloc();
+        }
+        block b = {p, size};
+        this->blocks_.push_back(b);
+    }
+
+    void release_blocks() {
+        for (size_t i = 0; i < this->blocks_.size(); i++) {
+            std::free(this->blocks_[i].data);
+        }
+        this->blocks_.clear();
+    }
+
+public:
+
+    explicit arena(size_t block_size = 1 << 16) : current_(0), offset_(0),
+    block_size_(block_size), used_(0) {
+    }
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena() {
+        this->release_blocks();
+    }
+
+    /**
+     * @brief Allocate bytes aligned to alignment, a power of two no larger
+     * than 64.
+     */
+    void* allocate(size_t bytes, size_t alignment = alignof (std::max_align_t)) {
+        for (;;) {
+            if (this->current_ < this->blocks_.size()) {
+                block& b = this->blocks_[this->current_];
+                size_t start = (this->offset_ + alignment - 1) & ~(alignment - 1);
+                if (start + bytes <= b.size) {
+                    this->used_ += start + bytes - this->offset_;
+                    this->offset_ = start + bytes;
+                    return b.data + start;
+                }
+                if (this->current_ + 1 < this->blocks_.size()) {
+                    this->current_++;
+                    this->offset_ = 0;
+                    continue;
+                }
+            }
+            this->add_block(bytes);
+            this->current_ = this->blocks_.size() - 1;
+            this->offset_ = 0;
+        }
+    }
+
+    inline void deallocate(void*, size_t) {
+    }
+
+    /**
+     * @brief Release all allocations and keep the memory for reuse.
+     */
+    void reset() {
+        if (this->blocks_.size() > 1) {
+            size_t total = this->capacity();
+            this->release_blocks();
+            this->add_block(total);
+        }
+        this->current_ = 0;
+        this->offset_ = 0;
+        this->used_ = 0;
+    }
+
+    /**
+     * @brief Bytes reserved from the heap.
+     */
+    size_t capacity() const {
+        size_t ret = 0;
+        for (size_t i = 0; i < this->blocks_.size(); i++) {
+            ret += this->blocks_[i].size;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Bytes handed out since the last reset, including alignment
+     * padding.
+     */
+    inline size_t used() const {
+        return this->used_;
+    }
+};
+
+/**
+ * @brief Standard allocator drawing from an arena.
+ */
+template <class T>
+class arena_allocator {
+public:
+    typedef T value_type;
+    arena* arena_;
+
+    explicit arena_allocator(arena* a) : arena_(a) {
+    }
+
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other) : arena_(other.arena_) {
+    }
+
+    inline T* allocate(size_t n) {
+        return static_cast<T*> (this->arena_->allocate(n * sizeof (T), alignof (T)));
+    }
+
+    inline void deallocate(T* p, size_t n) {
+        this->arena_->deallocate(p, n * sizeof (T));
+    }
+
+    template <class U>
+    inline bool operator==(const arena_allocator<U>& other) const {
+        return this->arena_ == other.arena_;
+    }
+
+    template <class U>
+    inline bool operator!=(const arena_allocator<U>& other) const {
+        return this->arena_ != other.arena_;
+    }
+};
+
+}  // namespace fims
+
+#endif /* FIMS_ARENA_HPP */
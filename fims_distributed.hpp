@@ -0,0 +1,246 @@
+/*! \file fims_distributed.hpp
+ */
+
+/*
+ * File:   fims_distributed.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * Transport for distributed evaluation. A population given a communicator
+ * evaluates only the area blocks assigned to its rank and exchanges small
+ * per-area boundary quantities and objective contributions through it.
+ *
+ *   serial_communicator  one rank, no communication
+ *   local_group          ranks as threads of one process, for testing and
+ *                        scaling runs without an MPI installation
+ *   mpi_communicator     MPI, compiled in with FIMS_MPI
+ *
+ */
+#ifndef FIMS_DISTRIBUTED_HPP
+#define FIMS_DISTRIBUTED_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef FIMS_MPI
+#include <mpi.h>
+#endif
+
+namespace fims {
+
+/**
+ * @brief Collective operations among the ranks evaluating one model.
+ *
+ * Every rank must make the same sequence of collective calls with the
+ * same sizes.
+ */
+class communicator {
+public:
+
+    virtual ~communicator() {
+    }
+
+    virtual size_t rank() const = 0;
+
+    virtual size_t size() const = 0;
+
+    /**
+     * @brief Replace values with their element-wise sum over all ranks.
+     * The result is identical on every rank and deterministic for a fixed
+     * number of ranks.
+     */
+    virtual void allreduce_sum(double* values, size_t n) = 0;
+
+    /**
+     * @brief Smallest value over all ranks, returned on every rank.
+     */
+    virtual size_t allreduce_min(size_t value) = 0;
+
+    virtual void barrier() = 0;
+};
+
+/**
+ * @brief A single rank.
+ */
+class serial_communicator : public communicator {
+public:
+
+    size_t rank() const {
+        return 0;
+    }
+
+    size_t size() const {
+        return 1;
+    }
+
+    void allreduce_sum(double*, size_t) {
+    }
+
+    size_t allreduce_min(size_t value) {
+        return value;
+    }
+
+    void barrier() {
+    }
+};
+
+/**
+ * @brief nranks ranks in one process, each driven by its own thread. Sums
+ * are taken in rank order, so they are reproducible.
+ */
+class local_group {
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    size_t nranks_;
+    size_t arrived_;
+    size_t generation_;
+    std::vector<const double*> inputs_; //one per rank, set by allreduce_sum
+    std::vector<size_t> minima_; //one per rank, set by allreduce_min
+
+    class member : public communicator {
+        local_group* group_;
+        size_t rank_;
+        std::vector<double> result_;
+    public:
+
+        member(local_group* group, size_t rank) : group_(group), rank_(rank) {
+        }
+
+        size_t rank() const {
+            return this->rank_;
+        }
+
+        size_t size() const {
+            return this->group_->nranks_;
+        }
+
+        void allreduce_sum(double* values, size_t n) {
+            local_group& g = *this->group_;
+            g.inputs_[this->rank_] = values;
+            g.wait();
+            this->result_.assign(n, 0.0);
+            for (size_t r = 0; r < g.nranks_; r++) {
+                const double* in = g.inputs_[r];
+                for (size_t i = 0; i < n; i++) {
+                    this->result_[i] += in[i];
+                }
+            }
+            //nobody may overwrite an input before every rank has read it
+            g.wait();
+            for (size_t i = 0; i < n; i++) {
+                values[i] = this->result_[i];
+            }
+        }
+
+        size_t allreduce_min(size_t value) {
+            local_group& g = *this->group_;
+            g.minima_[this->rank_] = value;
+            g.wait();
+            size_t ret = g.minima_[0];
+            for (size_t r = 1; r < g.nranks_; r++) {
+                ret = std::min(ret, g.minima_[r]);
+            }
+            g.wait();
+            return ret;
+        }
+
+        void barrier() {
+            this->group_->wait();
+        }
+    };
+
+    std::vector<std::shared_ptr<member> > members_;
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        size_t generation = this->generation_;
+        if (++this->arrived_ == this->nranks_) {
+            this->arrived_ = 0;
+            this->generation_++;
+            this->cv_.notify_all();
+            return;
+        }
+        this->cv_.wait(lock, [&] {
+            return this->generation_ != generation;
+        });
+    }
+
+public:
+
+    explicit local_group(size_t nranks) : nranks_(nranks == 0 ? 1 : nranks),
+    arrived_(0), generation_(0), inputs_(nranks_, nullptr), minima_(nranks_, 0) {
+        for (size_t r = 0; r < this->nranks_; r++) {
+            this->members_.push_back(std::make_shared<member>(this, r));
+        }
+    }
+
+    local_group(const local_group&) = delete;
+    local_group& operator=(const local_group&) = delete;
+
+    inline size_t size() const {
+        return this->nranks_;
+    }
+
+    /**
+     * @brief Communicator of rank r, valid for the lifetime of the group.
+     */
+    inline std::shared_ptr<communicator> rank(size_t r) {
+        return this->members_[r];
+    }
+};
+
+#ifdef FIMS_MPI
+
+/**
+ * @brief MPI transport over a communicator, MPI_COMM_WORLD by default.
+ * MPI must be initialized by the caller.
+ */
+class mpi_communicator : public communicator {
+    MPI_Comm comm_;
+    size_t rank_;
+    size_t size_;
+public:
+
+    explicit mpi_communicator(MPI_Comm comm = MPI_COMM_WORLD) : comm_(comm) {
+        int rank = 0;
+        int size = 1;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+        this->rank_ = static_cast<size_t> (rank);
+        this->size_ = static_cast<size_t> (size);
+    }
+
+    size_t rank() const {
+        return this->rank_;
+    }
+
+    size_t size() const {
+        return this->size_;
+    }
+
+    void allreduce_sum(double* values, size_t n) {
+        MPI_Allreduce(MPI_IN_PLACE, values, static_cast<int> (n), MPI_DOUBLE,
+                MPI_SUM, this->comm_);
+    }
+
+    size_t allreduce_min(size_t value) {
+        unsigned long long v = value;
+        MPI_Allreduce(MPI_IN_PLACE, &v, 1, MPI_UNSIGNED_LONG_LONG, MPI_MIN, this->comm_);
+        return static_cast<size_t> (v);
+    }
+
+    void barrier() {
+        MPI_Barrier(this->comm_);
+    }
+};
+#endif
+
+}  // namespace fims
+
+#endif /* FIMS_DISTRIBUTED_HPP */
@@ -0,0 +1,367 @@
+/*! \file fims_expression.hpp
+ */
+
+/*
+ * File:   fims_expression.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * Lazy elementwise vector math on top of fims_math.hpp. Expressions are
+ * small value types that describe a computation; nothing is evaluated
+ * until a reduction or an assignment walks the expression once, so a chain
+ * such as
+ *
+ *   namespace fx = fims::expr;
+ *   T nll = fx::sum(fx::lgamma(fx::view(x) + 1.0));
+ *
+ * runs as a single loop with no intermediate vectors. Works for double and
+ * for AD types, the elementwise functions forward to fims_math.hpp. Call
+ * the functions qualified (fx::exp), fims::exp would take the expression
+ * itself as its argument.
+ *
+ */
+#ifndef FIMS_EXPRESSION_HPP
+#define FIMS_EXPRESSION_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include "fims_math.hpp"
+
+namespace fims {
+namespace expr {
+
+/**
+ * @brief Base of all expressions, E is the derived type.
+ */
+template <class E>
+struct expression {
+
+    inline const E& self() const {
+        return static_cast<const E&> (*this);
+    }
+};
+
+template <class E>
+struct is_expression : std::is_base_of<expression<E>, E> {
+};
+
+/**
+ * @brief Non-owning view of n contiguous values. The data must outlive
+ * every expression built from it.
+ */
+template <class T>
+class vector_ref : public expression<vector_ref<T> > {
+    const T* data_;
+    size_t size_;
+public:
+    typedef T value_type;
+
+    vector_ref(const T* data, size_t size) : data_(data), size_(size) {
+    }
+
+    inline const T& operator[](size_t i) const {
+        return this->data_[i];
+    }
+
+    inline size_t size() const {
+        return this->size_;
+    }
+};
+
+/**
+ * @brief A scalar broadcast to every element. Its size is 0, so it never
+ * determines the size of an expression.
+ */
+template <class T>
+class scalar : public expression<scalar<T> > {
+    T value_;
+public:
+    typedef T value_type;
+
+    explicit scalar(const T& value) : value_(value) {
+    }
+
+    inline const T& operator[](size_t) const {
+        return this->value_;
+    }
+
+    inline size_t size() const {
+        return 0;
+    }
+};
+
+/**
+ * @brief Op applied to every element of E.
+ */
+template <class Op, class E>
+class unary : public expression<unary<Op, E> > {
+    Op op_;
+    E e_;
+public:
+    typedef typename E::value_type value_type;
+
+    unary(const Op& op, const E& e) : op_(op), e_(e) {
+    }
+
+    inline value_type operator[](size_t i) const {
+        return this->op_(this->e_[i]);
+    }
+
+    inline size_t size() const {
+        return this->e_.size();
+    }
+};
+
+/**
+ * @brief Op applied elementwise to L and R, which must have the same size
+ * unless one of them is a broadcast scalar.
+ */
+template <class Op, class L, class R>
+class binary : public expression<binary<Op, L, R> > {
+    L l_;
+    R r_;
+public:
+    typedef typename L::value_type value_type;
+
+    binary(const L& l, const R& r) : l_(l), r_(r) {
+        assert(l.size() == r.size() || l.size() == 0 || r.size() == 0);
+    }
+
+    inline value_type operator[](size_t i) const {
+        return Op::apply(this->l_[i], this->r_[i]);
+    }
+
+    inline size_t size() const {
+        return this->l_.size() != 0 ? this->l_.size() : this->r_.size();
+    }
+};
+
+template <class T>
+inline vector_ref<T> view(const std::vector<T>& v) {
+    return vector_ref<T>(v.data(), v.size());
+}
+
+template <class T>
+inline vector_ref<T> view(const T* data, size_t size) {
+    return vector_ref<T>(data, size);
+}
+
+namespace detail {
+
+//plain values become broadcast scalars of the value type of the other
+//operand, so double constants combine with AD expressions; expressions
+//pass through
+
+template <class E, class Other, bool = is_expression<E>::value>
+struct operand {
+    typedef E type;
+
+    static inline const E& wrap(const E& e) {
+        return e;
+    }
+};
+
+template <class T, class Other>
+struct operand<T, Other, false> {
+    typedef scalar<typename Other::value_type> type;
+
+    static inline type wrap(const T& t) {
+        return type(static_cast<typename Other::value_type> (t));
+    }
+};
+
+struct add_op {
+
+    template <class T>
+    static inline T apply(const T& a, const T& b) {
+        return a + b;
+    }
+};
+
+struct subtract_op {
+
+    template <class T>
+    static inline T apply(const T& a, const T& b) {
+        return a - b;
+    }
+};
+
+struct multiply_op {
+
+    template <class T>
+    static inline T apply(const T& a, const T& b) {
+        return a * b;
+    }
+};
+
+struct divide_op {
+
+    template <class T>
+    static inline T apply(const T& a, const T& b) {
+        return a / b;
+    }
+};
+
+struct exp_op {
+
+    template <class T>
+    inline T operator()(const T& x) const {
+        return fims::exp(x);
+    }
+#ifdef STD_LIB
+
+    inline double operator()(const double& x) const {
+        return fims::detail::exp_batch(x);
+    }
+#endif
+};
+
+struct log_op {
+
+    template <class T>
+    inline T operator()(const T& x) const {
+        return fims::log(x);
+    }
+#ifdef STD_LIB
+
+    inline double operator()(const double& x) const {
+        return fims::detail::log_batch(x);
+    }
+#endif
+};
+
+template <class LgammaPolicy>
+struct lgamma_op {
+
+    template <class T>
+    inline T operator()(const T& x) const {
+        return LgammaPolicy::eval(x);
+    }
+};
+
+template <class T>
+struct logistic_op {
+    T median;
+    T slope;
+
+    inline T operator()(const T& x) const {
+        return static_cast<T> (1.0) / (static_cast<T> (1.0) +
+                exp_op()(-1.0 * this->slope * (x - this->median)));
+    }
+};
+
+template <class Op, class L, class R>
+struct binary_result {
+    typedef typename operand<L, R>::type left;
+    typedef typename operand<R, L>::type right;
+    typedef binary<Op, left, right> type;
+
+    static inline type make(const L& l, const R& r) {
+        return type(operand<L, R>::wrap(l), operand<R, L>::wrap(r));
+    }
+};
+
+//at least one side must be an expression, so the operators below never
+//capture plain arithmetic
+template <class L, class R>
+struct any_expression : std::integral_constant<bool,
+is_expression<L>::value || is_expression<R>::value> {
+};
+
+}  // namespace detail
+
+#define FIMS_EXPRESSION_OPERATOR(symbol, op) \
+    template <class L, class R, class = typename std::enable_if< \
+        detail::any_expression<L, R>::value>::type> \
+    inline typename detail::binary_result<detail::op, L, R>::type \
+    operator symbol(const L& l, const R& r) { \
+        return detail::binary_result<detail::op, L, R>::make(l, r); \
+    }
+
+FIMS_EXPRESSION_OPERATOR(+, add_op)
+FIMS_EXPRESSION_OPERATOR(-, subtract_op)
+FIMS_EXPRESSION_OPERATOR(*, multiply_op)
+FIMS_EXPRESSION_OPERATOR(/, divide_op)
+
+#undef FIMS_EXPRESSION_OPERATOR
+
+/**
+ * @brief Elementwise exp. For double, arguments are clamped to
+ * [-708, 709], so results saturate near the smallest and largest normal
+ * doubles instead of becoming 0 or inf as with the scalar fims::exp.
+ */
+template <class E>
+inline unary<detail::exp_op, E> exp(const expression<E>& e) {
+    return unary<detail::exp_op, E>(detail::exp_op(), e.self());
+}
+
+/**
+ * @brief Elementwise log. For double this is detail::log_batch, which is
+ * not clamped and gives -inf, NaN and inf as the scalar fims::log does.
+ */
+template <class E>
+inline unary<detail::log_op, E> log(const expression<E>& e) {
+    return unary<detail::log_op, E>(detail::log_op(), e.self());
+}
+
+/**
+ * @brief Elementwise log gamma, using the same policies as dmultinom.
+ */
+template <class LgammaPolicy = default_lgamma_policy, class E>
+inline unary<detail::lgamma_op<LgammaPolicy>, E> lgamma(const expression<E>& e) {
+    return unary<detail::lgamma_op<LgammaPolicy>, E>(detail::lgamma_op<LgammaPolicy>(), e.self());
+}
+
+template <class E>
+inline unary<detail::logistic_op<typename E::value_type>, E>
+logistic(const typename E::value_type& median, const typename E::value_type& slope,
+        const expression<E>& e) {
+    detail::logistic_op<typename E::value_type> op = {median, slope};
+    return unary<detail::logistic_op<typename E::value_type>, E>(op, e.self());
+}
+
+/**
+ * @brief Sum of all elements, evaluated in one pass.
+ */
+template <class E>
+inline typename E::value_type sum(const expression<E>& e) {
+    const E& x = e.self();
+    typename E::value_type ret = 0.0;
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; i++) {
+        ret += x[i];
+    }
+    return ret;
+}
+
+/**
+ * @brief Evaluate into out, which must hold size() elements.
+ */
+template <class E>
+inline void assign(typename E::value_type* out, const expression<E>& e) {
+    const E& x = e.self();
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; i++) {
+        out[i] = x[i];
+    }
+}
+
+/**
+ * @brief Evaluate into a new vector.
+ */
+template <class E>
+inline std::vector<typename E::value_type> evaluate(const expression<E>& e) {
+    std::vector<typename E::value_type> ret(e.self().size());
+    assign(ret.data(), e);
+    return ret;
+}
+
+}  // namespace expr
+}  // namespace fims
+
+#endif /* FIMS_EXPRESSION_HPP */
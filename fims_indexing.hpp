@@ -0,0 +1,1873 @@
+/* 
+ * File:   fims_indexing.hpp
+ * Author: Matthew Supernaw
+ *
+ * Created on December 17, 2021, 12:42 PM
+ * 
+ * Object partitioning and time indexing for FIMS. The example driver is
+ * in fims_indexing.cpp, benchmarks are in benchmarks/.
+ * 
+ */
+
+#ifndef FIMS_INDEXING_HPP
+#define FIMS_INDEXING_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "fims_arena.hpp"
+#include "fims_distributed.hpp"
+#include "fims_instrumentation.hpp"
+#include "fims_output.hpp"
+#include "fims_ragged_file.hpp"
+#include "fims_snapshot.hpp"
+#include "fims_thread_pool.hpp"
+
+/**
+ * Layout of the folded time/age index.
+ */
+enum class index_layout {
+    padded, //every year is padded to seasons_max_ seasons
+    ragged //years are packed back to back, no padding
+};
+
+/**
+ * Non-owning view into the block of derived quantities for a single
+ * partition. The memory is owned by a derived_quantity_store.
+ */
+class derived_quantity_view {
+    double* data_;
+    size_t size_;
+public:
+
+    derived_quantity_view() : data_(NULL), size_(0) {
+    }
+
+    derived_quantity_view(double* data, size_t size) : data_(data), size_(size) {
+    }
+
+    inline double& operator[](const size_t& i) {
+        return this->data_[i];
+    }
+
+    inline const double& operator[](const size_t& i) const {
+        return this->data_[i];
+    }
+
+    inline size_t size() const {
+        return this->size_;
+    }
+
+    inline double* data() {
+        return this->data_;
+    }
+
+    inline const double* data() const {
+        return this->data_;
+    }
+
+    inline double* begin() {
+        return this->data_;
+    }
+
+    inline double* end() {
+        return this->data_ + this->size_;
+    }
+};
+
+/**
+ * Immutable model calendar, built once and shared by every model object
+ * through a std::shared_ptr<const calendar>. It is the one place that
+ * holds the season offsets and the time/age index math.
+ */
+class calendar {
+public:
+    size_t nyears_; //number of years
+    size_t nages_; //number of ages
+    size_t seasons_max_; //max seasons for all years
+    index_layout layout_; //folding used by get_index
+    std::vector<double> season_offsets_; //season offsets flattened by time step, no padding
+    std::vector<size_t> nseasons_; //number of seasons per year
+    std::vector<size_t> time_step_ids_; //cumulative time step id of the first season in each year, size nyears_ + 1
+    std::vector<size_t> season_starts_; //first folded time step of each year for layout_, size nyears_ + 1
+    std::vector<double> ages_; //age classes, may be empty
+    std::vector<double> fractional_ages_; //age at the start of each season, folded by get_index, empty without ages_
+
+    /**
+     * Constructor for variable season data.
+     * 
+     * @param nyears
+     * @param season_offsets
+     * @param nages
+     * @param layout
+     * @param ages
+     */
+    calendar(size_t nyears, const std::vector<std::vector<double> >& season_offsets,
+            size_t nages, index_layout layout = index_layout::ragged,
+            std::vector<double> ages = std::vector<double>()) :
+    nyears_(nyears), nages_(nages), seasons_max_(0), layout_(layout), ages_(std::move(ages)) {
+        this->nseasons_.resize(nyears);
+        for (size_t i = 0; i < nyears; i++) {
+            this->nseasons_[i] = season_offsets[i].size();
+            this->season_offsets_.insert(this->season_offsets_.end(),
+                    season_offsets[i].begin(), season_offsets[i].end());
+        }
+        this->build();
+    }
+
+    /**
+     * Constructor for variable season data from a ragged view, one row of
+     * season offsets per year, e.g. a mapped_ragged_file. The offsets are
+     * copied in one pass, the view is not referenced afterwards.
+     * 
+     * @param season_offsets
+     * @param nages
+     * @param layout
+     * @param ages
+     */
+    calendar(const fims::ragged_view& season_offsets, size_t nages,
+            index_layout layout = index_layout::ragged,
+            std::vector<double> ages = std::vector<double>()) :
+    nyears_(season_offsets.size()), nages_(nages), seasons_max_(0), layout_(layout), ages_(std::move(ages)) {
+        this->nseasons_.resize(this->nyears_);
+        for (size_t i = 0; i < this->nyears_; i++) {
+            this->nseasons_[i] = season_offsets.row_size(i);
+        }
+        this->season_offsets_.assign(season_offsets.values,
+                season_offsets.values + season_offsets.row_starts[this->nyears_]);
+        this->build();
+    }
+
+    /**
+     * Constructor for variable season data already in flat form, the
+     * number of seasons of each year and the season offsets of all years
+     * back to back. Both vectors are moved in, pass temporaries or
+     * std::move to build without copying.
+     * 
+     * @param nseasons
+     * @param season_offsets
+     * @param nages
+     * @param layout
+     * @param ages
+     */
+    calendar(std::vector<size_t> nseasons, std::vector<double> season_offsets,
+            size_t nages, index_layout layout = index_layout::ragged,
+            std::vector<double> ages = std::vector<double>()) :
+    nyears_(nseasons.size()), nages_(nages), seasons_max_(0), layout_(layout),
+    season_offsets_(std::move(season_offsets)), nseasons_(std::move(nseasons)),
+    ages_(std::move(ages)) {
+        size_t total = 0;
+        for (size_t i = 0; i < this->nyears_; i++) {
+            total += this->nseasons_[i];
+        }
+        if (total != this->season_offsets_.size()) {
+            std::ostringstream os;
+            os << "calendar: " << this->season_offsets_.size() <<
+                    " season offsets for " << total << " seasons";
+            throw std::invalid_argument(os.str());
+        }
+        this->build();
+    }
+
+    /**
+     * Constructor for fixed season data.
+     * 
+     * @param nyears
+     * @param nseasons
+     * @param nages
+     * @param layout
+     * @param ages
+     */
+    calendar(size_t nyears, size_t nseasons, size_t nages,
+            index_layout layout = index_layout::ragged,
+            std::vector<double> ages = std::vector<double>()) :
+    nyears_(nyears), nages_(nages), seasons_max_(0), layout_(layout), ages_(std::move(ages)) {
+        this->nseasons_.assign(nyears, nseasons);
+        this->season_offsets_.resize(nyears * nseasons);
+        for (size_t i = 0; i < nyears; i++) {
+            for (size_t j = 0; j < nseasons; j++) {
+                this->season_offsets_[i * nseasons + j] = (j + 1.0) / static_cast<double> (nseasons);
+            }
+        }
+        this->build();
+    }
+
+    /**
+     * Return a calendar with the same seasons and ages on another layout.
+     * 
+     * @param layout
+     * @return 
+     */
+    std::shared_ptr<const calendar> with_layout(index_layout layout) const {
+        std::shared_ptr<calendar> ret = std::make_shared<calendar>(*this);
+        ret->layout_ = layout;
+        ret->build();
+        return ret;
+    }
+
+    /**
+     * Returns the number of folded time steps, including padding.
+     * 
+     * @return 
+     */
+    inline size_t get_time_steps() const {
+        return this->season_starts_[this->nyears_];
+    }
+
+    /**
+     * Returns the number of folded time and age elements, including padding.
+     * 
+     * @return 
+     */
+    inline size_t get_size() const {
+        return this->get_time_steps() * this->nages_;
+    }
+
+    /**
+     * Return dimension folded index for time and age;
+     * 
+     * @param year
+     * @param season
+     * @param age
+     * @return 
+     */
+    inline size_t get_index(const size_t& year, const size_t& season,
+            const size_t& age) const {
+        return (this->season_starts_[year] + season) * this->nages_ + age;
+    }
+
+    /**
+     * Returns the cumulative time step id of a season, counting only
+     * seasons that exist.
+     * 
+     * @param year
+     * @param season
+     * @return 
+     */
+    inline size_t get_time_step_id(const size_t& year, const size_t& season) const {
+        return this->time_step_ids_[year] + season;
+    }
+
+    /**
+     * Returns the offset of a season within its year.
+     * 
+     * @param year
+     * @param season
+     * @return 
+     */
+    inline double get_season_offset(const size_t& year, const size_t& season) const {
+        return this->season_offsets_[this->get_time_step_id(year, season)];
+    }
+
+private:
+
+    /**
+     * Build the derived tables. For the ragged layout the season starts
+     * are the prefix sum of the number of seasons per year, for the padded
+     * layout every year starts at a multiple of seasons_max_. Either way
+     * get_index folds through the same table.
+     */
+    void build() {
+        this->seasons_max_ = 0;
+        for (size_t i = 0; i < this->nyears_; i++) {
+            this->seasons_max_ = std::max(this->seasons_max_, this->nseasons_[i]);
+        }
+
+        this->time_step_ids_.resize(this->nyears_ + 1);
+        this->season_starts_.resize(this->nyears_ + 1);
+        this->time_step_ids_[0] = 0;
+        this->season_starts_[0] = 0;
+        for (size_t i = 0; i < this->nyears_; i++) {
+            size_t n = this->layout_ == index_layout::ragged ?
+                    this->nseasons_[i] : this->seasons_max_;
+            this->time_step_ids_[i + 1] = this->time_step_ids_[i] + this->nseasons_[i];
+            this->season_starts_[i + 1] = this->season_starts_[i] + n;
+        }
+
+        this->fractional_ages_.clear();
+        if (this->ages_.size() == this->nages_ && this->nages_ > 0) {
+            this->fractional_ages_.assign(this->get_size(), 0.0);
+            for (size_t y = 0; y < this->nyears_; y++) {
+                for (size_t s = 0; s < this->nseasons_[y]; s++) {
+                    //seasons start where the previous one ends
+                    double start = s == 0 ? 0.0 : this->get_season_offset(y, s - 1);
+                    for (size_t a = 0; a < this->nages_; a++) {
+                        this->fractional_ages_[this->get_index(y, s, a)] = this->ages_[a] + start;
+                    }
+                }
+            }
+        }
+    }
+};
+
+/**
+ * Lightweight, copyable time and age indexer. Dimensions given as template
+ * parameters are compile-time constants, 0 means the dimension is read
+ * from the calendar at run time. A nonzero NSeasons requires every year to
+ * have NSeasons seasons, a nonzero NAges requires nages == NAges.
+ * 
+ * The indexer borrows the calendar tables, the calendar must outlive it.
+ */
+template <size_t NSeasons = 0, size_t NAges = 0 >
+class time_age_indexer {
+    const size_t* season_starts_;
+    const size_t* nseasons_;
+    size_t nages_;
+public:
+
+    explicit time_age_indexer(const calendar& cal) :
+    season_starts_(cal.season_starts_.data()), nseasons_(cal.nseasons_.data()),
+    nages_(cal.nages_) {
+        if (NAges != 0 && cal.nages_ != NAges) {
+            std::ostringstream os;
+            os << "time_age_indexer: calendar has " << cal.nages_ << " ages, expected " << NAges;
+            throw std::invalid_argument(os.str());
+        }
+        if (NSeasons != 0) {
+            for (size_t y = 0; y < cal.nyears_; y++) {
+                if (cal.nseasons_[y] != NSeasons) {
+                    std::ostringstream os;
+                    os << "time_age_indexer: year " << y << " has " << cal.nseasons_[y]
+                            << " seasons, expected " << NSeasons;
+                    throw std::invalid_argument(os.str());
+                }
+            }
+        }
+    }
+
+    /**
+     * Returns the number of ages.
+     */
+    inline size_t get_ages() const {
+        return NAges != 0 ? NAges : this->nages_;
+    }
+
+    /**
+     * Returns the number of seasons for a given year.
+     * 
+     * @param year
+     */
+    inline size_t get_seasons(const size_t& year) const {
+        return NSeasons != 0 ? NSeasons : this->nseasons_[year];
+    }
+
+    /**
+     * Return dimension folded index for time and age;
+     * 
+     * @param year
+     * @param season
+     * @param age
+     * @return 
+     */
+    inline size_t get_index(const size_t& year, const size_t& season,
+            const size_t& age) const {
+        size_t t = NSeasons != 0 ? year * NSeasons : this->season_starts_[year];
+        return (t + season) * this->get_ages() + age;
+    }
+
+    /**
+     * Contiguous view of the ages in one season of a folded buffer.
+     * 
+     * @param data
+     * @param year
+     * @param season
+     * @return 
+     */
+    inline derived_quantity_view season(double* data, const size_t& year,
+            const size_t& season) const {
+        return derived_quantity_view(data + this->get_index(year, season, 0), this->get_ages());
+    }
+
+    /**
+     * Contiguous view of all seasons and ages in one year of a folded
+     * buffer. Padding after the last season of the year is excluded.
+     * 
+     * @param data
+     * @param year
+     * @return 
+     */
+    inline derived_quantity_view year(double* data, const size_t& year) const {
+        return derived_quantity_view(data + this->get_index(year, 0, 0),
+                this->get_seasons(year) * this->get_ages());
+    }
+};
+
+/**
+ *Base class, holds common modeling information.
+ */
+class model_base {
+    inline static std::atomic<size_t> id_g{0}; //used to create unique identifier for model objects, built concurrently by in-process ranks
+public:
+    size_t nyears_; //number of years
+    size_t nseasons_; //number of seasons, equals seasons_max_ for variable season lengths
+    size_t nages_; //number of ages
+    size_t seasons_max_; //max seasons for all years
+    size_t object_id; //objects unique identifier
+    std::shared_ptr<const calendar> calendar_; //shared time index, seasons offsets can be fixed or variable
+    const size_t* season_starts_; //cached from calendar_ for get_index
+
+    /**
+     * Constructor from a shared calendar.
+     * 
+     * @param cal
+     */
+    explicit model_base(std::shared_ptr<const calendar> cal) {
+        this->object_id = model_base::id_g++;
+        this->set_calendar(cal);
+    }
+
+    /**
+     * Constructor for variable season data.
+     * 
+     * @param nyears
+     * @param season_offsets
+     * @param nages
+     */
+    model_base(size_t nyears, const std::vector<std::vector<double> >& season_offsets, size_t nages) :
+    model_base(std::make_shared<const calendar>(nyears, season_offsets, nages)) {
+    }
+
+    /**
+     * Constructor for variable season data from a ragged view.
+     * 
+     * @param season_offsets
+     * @param nages
+     */
+    model_base(const fims::ragged_view& season_offsets, size_t nages) :
+    model_base(std::make_shared<const calendar>(season_offsets, nages)) {
+    }
+
+    /**
+     * Constructor for fixed season data.
+     * 
+     * @param nyears
+     * @param nseasons
+     * @param nages
+     */
+    model_base(size_t nyears, size_t nseasons, size_t nages) :
+    model_base(std::make_shared<const calendar>(nyears, nseasons, nages)) {
+    }
+
+    /**
+     * Share another calendar. Buffers folded with the previous calendar
+     * must be reallocated.
+     * 
+     * @param cal
+     */
+    void set_calendar(std::shared_ptr<const calendar> cal) {
+        this->calendar_ = cal;
+        this->nyears_ = cal->nyears_;
+        this->nseasons_ = cal->seasons_max_;
+        this->nages_ = cal->nages_;
+        this->seasons_max_ = cal->seasons_max_;
+        this->season_starts_ = cal->season_starts_.data();
+    }
+
+    /**
+     * Select the index layout. Buffers folded with the previous layout
+     * must be reallocated.
+     * 
+     * @param layout
+     */
+    void set_index_layout(index_layout layout) {
+        if (layout != this->calendar_->layout_) {
+            this->set_calendar(this->calendar_->with_layout(layout));
+        }
+    }
+
+    /**
+     * Returns the number of folded time steps, including padding.
+     * 
+     * @return 
+     */
+    inline size_t get_time_steps() const {
+        return this->season_starts_[this->nyears_];
+    }
+
+    /**
+     * Returns the number of folded time and age elements, including padding.
+     * 
+     * @return 
+     */
+    inline size_t get_size() const {
+        return this->get_time_steps() * this->nages_;
+    }
+
+    /**
+     * Return dimension folded index for time and age;
+     * 
+     * @param year
+     * @param season
+     * @param age
+     * @return 
+     */
+    inline size_t get_index(
+            const size_t& year,
+            const size_t& season,
+            const size_t& age) const {
+
+        return (this->season_starts_[year] + season) * this->nages_ + age;
+    }
+
+    /**
+     * Return dimension folded index for time only;
+     * 
+     * @param year
+     * @param season
+     * @return 
+     */
+    inline size_t get_index(
+            const size_t& year,
+            const size_t& season) const {
+
+        return this->season_starts_[year] * this->nages_ + season;
+    }
+
+    /**
+     * Returns the number of seasons for a given year
+     * 
+     * @param year
+     * @return 
+     */
+    inline size_t get_seasons(const size_t& year) const {
+        return this->calendar_->nseasons_[year];
+    }
+
+    /**
+     * Returns an indexer over this object's calendar, see time_age_indexer.
+     * 
+     * @return 
+     */
+    template <size_t NSeasons = 0, size_t NAges = 0 >
+    time_age_indexer<NSeasons, NAges> get_indexer() const {
+        return time_age_indexer<NSeasons, NAges>(*this->calendar_);
+    }
+
+
+
+};
+
+/**
+ * Contiguous, aligned storage for the derived quantities of every partition
+ * of a population, laid out as [partition][year][season][age] with the
+ * partitions in partition_table order ([sex][area][...]). Each partition
+ * block is padded to start on a cache line boundary. Within a block the
+ * elements are folded by model_base::get_index.
+ */
+class derived_quantity_store {
+
+    struct aligned_deleter {
+        bool owned; //false when the buffer belongs to an arena
+
+        aligned_deleter() : owned(true) {
+        }
+
+        void operator()(double* p) const {
+            if (this->owned) {
+                std::free(p);
+            }
+        }
+    };
+
+    std::unique_ptr<double, aligned_deleter> data_;
+    size_t size_;
+    std::shared_ptr<const void> external_; //keeps adopted memory alive
+
+public:
+    static const size_t alignment = 64; //bytes, one cache line
+    size_t npartitions_; //number of partitions
+    size_t partition_size_; //number of year/season/age elements in a partition
+    size_t partition_stride_; //partition size padded to the alignment
+
+    derived_quantity_store() : size_(0), npartitions_(0),
+    partition_size_(0), partition_stride_(0) {
+    }
+
+    derived_quantity_store(const derived_quantity_store&) = delete;
+    derived_quantity_store& operator=(const derived_quantity_store&) = delete;
+
+    /**
+     * Allocate zero initialized storage for all partitions, from the heap
+     * or from an arena that must outlive the buffer. Any views handed out
+     * before this call are invalidated. Without zero_fill the memory is
+     * left untouched so that each partition can be first touched, and
+     * zeroed, by the thread that will own it.
+     * 
+     * @param npartitions
+     * @param partition_size
+     * @param pool optional arena
+     * @param zero_fill
+     */
+    void resize(size_t npartitions, size_t partition_size, fims::arena* pool = NULL,
+            bool zero_fill = true) {
+        const size_t per_line = alignment / sizeof (double);
+        this->npartitions_ = npartitions;
+        this->partition_size_ = partition_size;
+        this->partition_stride_ = ((partition_size + per_line - 1) / per_line) * per_line;
+        this->size_ = npartitions * this->partition_stride_;
+
+        this->data_.reset();
+        this->external_.reset();
+        double* p = NULL;
+        if (this->size_ > 0) {
+            if (pool != NULL) {
+                p = static_cast<double*> (pool->allocate(this->size_ * sizeof (double), alignment));
+            } else {
+                p = static_cast<double*> (std::aligned_alloc(alignment, this->size_ * sizeof (double)));
+                if (p == NULL) {
+                    throw std::bad_alloc();
+                }
+            }
+            if (zero_fill) {
+                std::fill(p, p + this->size_, 0.0);
+            }
+        }
+        this->data_.get_deleter().owned = pool == NULL;
+        this->data_.reset(p);
+    }
+
+    /**
+     * Free or detach the buffer. Any views handed out are invalidated.
+     */
+    void release() {
+        this->data_.reset();
+        this->external_.reset();
+        this->size_ = 0;
+        this->npartitions_ = 0;
+    }
+
+    /**
+     * True when adopt would accept p with this layout: partition_stride is
+     * the stride resize would choose and p is 64 byte aligned.
+     * 
+     * @param p
+     * @param partition_size
+     * @param partition_stride
+     * @return 
+     */
+    static bool can_adopt(const double* p, size_t partition_size, size_t partition_stride) {
+        const size_t per_line = alignment / sizeof (double);
+        return partition_stride == ((partition_size + per_line - 1) / per_line) * per_line &&
+                reinterpret_cast<uintptr_t> (p) % alignment == 0;
+    }
+
+    /**
+     * Use memory owned by someone else, e.g. a mapped snapshot, laid out
+     * as resize would lay it out. owner is held until the store is
+     * resized or released. Any views handed out before this call are
+     * invalidated.
+     * 
+     * @param p npartitions * partition_stride doubles, 64 byte aligned
+     * @param npartitions
+     * @param partition_size
+     * @param partition_stride must match the stride resize would choose
+     * @param owner
+     */
+    void adopt(double* p, size_t npartitions, size_t partition_size,
+            size_t partition_stride, std::shared_ptr<const void> owner) {
+        if (!can_adopt(p, partition_size, partition_stride)) {
+            throw std::invalid_argument("derived_quantity_store::adopt: incompatible partition layout");
+        }
+        this->data_.reset();
+        this->npartitions_ = npartitions;
+        this->partition_size_ = partition_size;
+        this->partition_stride_ = partition_stride;
+        this->size_ = npartitions * partition_stride;
+        this->external_ = owner;
+        this->data_.get_deleter().owned = false;
+        this->data_.reset(p);
+    }
+
+    /**
+     * Return the folded offset of a partition block.
+     * 
+     * @param partition linear partition index, see partition_table
+     * @return 
+     */
+    inline size_t get_offset(const size_t& partition) const {
+        return partition * this->partition_stride_;
+    }
+
+    /**
+     * Return a non-owning view of a partition block.
+     * 
+     * @param partition linear partition index, see partition_table
+     * @return 
+     */
+    inline derived_quantity_view partition(const size_t& partition) {
+        return derived_quantity_view(this->data_.get() + this->get_offset(partition),
+                this->partition_size_);
+    }
+
+    /**
+     * Zero a partition block including its alignment padding.
+     * 
+     * @param partition
+     */
+    inline void zero(const size_t& partition) {
+        double* p = this->data_.get() + this->get_offset(partition);
+        std::fill(p, p + this->partition_stride_, 0.0);
+    }
+
+    inline double* data() {
+        return this->data_.get();
+    }
+
+    inline const double* data() const {
+        return this->data_.get();
+    }
+
+    inline size_t size() const {
+        return this->size_;
+    }
+};
+
+/**
+ * Dense table of partitions stored by value in row-major order over its
+ * axes. The first two axes are sex and area, further axes (growth morph,
+ * stock, ...) are optional. Lookups are index arithmetic and iteration is
+ * a linear walk over a std::vector, allocated with Allocator.
+ */
+template <class T, class Allocator = std::allocator<T> >
+class partition_table {
+    std::vector<size_t> dims_;
+    std::vector<T, Allocator> partitions_;
+public:
+
+    explicit partition_table(const Allocator& allocator = Allocator()) :
+    partitions_(allocator) {
+    }
+
+    /**
+     * Destroy all partitions and give their memory back to the allocator.
+     */
+    void release() {
+        std::vector<T, Allocator> empty(this->partitions_.get_allocator());
+        this->partitions_.swap(empty);
+    }
+
+    /**
+     * Remove all partitions and set the axes. Partitions are then added in
+     * row-major order with emplace_back.
+     * 
+     * @param dims
+     */
+    void reset(const std::vector<size_t>& dims) {
+        this->dims_ = dims;
+        size_t n = dims.empty() ? 0 : 1;
+        for (size_t i = 0; i < dims.size(); i++) {
+            n *= dims[i];
+        }
+        this->partitions_.clear();
+        this->partitions_.reserve(n);
+    }
+
+    template <class... Args>
+    inline T& emplace_back(Args&&... args) {
+        this->partitions_.emplace_back(std::forward<Args>(args)...);
+        return this->partitions_.back();
+    }
+
+    /**
+     * Return the linear index of a partition. Omitted trailing axes are
+     * taken as 0.
+     * 
+     * @param i one index per leading axis
+     * @return 
+     */
+    template <class... I>
+    inline size_t get_index(I... i) const {
+        const size_t idx[] = {static_cast<size_t> (i)...};
+        size_t ret = 0;
+        for (size_t k = 0; k < this->dims_.size(); k++) {
+            ret = ret * this->dims_[k] + (k < sizeof...(I) ? idx[k] : 0);
+        }
+        return ret;
+    }
+
+    template <class... I>
+    inline T& operator()(I... i) {
+        return this->partitions_[this->get_index(i...)];
+    }
+
+    inline T& operator[](const size_t& i) {
+        return this->partitions_[i];
+    }
+
+    inline const T& operator[](const size_t& i) const {
+        return this->partitions_[i];
+    }
+
+    inline size_t get_dim(const size_t& axis) const {
+        return this->dims_[axis];
+    }
+
+    inline size_t get_naxes() const {
+        return this->dims_.size();
+    }
+
+    inline size_t size() const {
+        return this->partitions_.size();
+    }
+
+    inline typename std::vector<T, Allocator>::iterator begin() {
+        return this->partitions_.begin();
+    }
+
+    inline typename std::vector<T, Allocator>::iterator end() {
+        return this->partitions_.end();
+    }
+};
+
+/**
+ * Area object
+ */
+class area : public model_base {
+public:
+
+    area(size_t nyears, size_t nseasons, size_t nages) :
+    model_base(nyears, nseasons, nages) {
+    }
+
+    explicit area(std::shared_ptr<const calendar> cal) :
+    model_base(cal) {
+    }
+
+};
+
+/**
+ * Base class for all population objects.
+ * Inherits from model_base
+ */
+class population_base : public model_base {
+public:
+
+    /**
+     * Constructor for fixed season size.
+     * 
+     * @param nyears
+     * @param nseasons
+     * @param nages
+     * @param ages
+     */
+    population_base(size_t nyears, size_t nseasons, size_t nages, std::vector<double> ages) :
+    model_base(std::make_shared<const calendar>(nyears, nseasons, nages,
+    index_layout::ragged, std::move(ages))) {//initialize base class
+
+    }
+
+    /**
+     * Constructor for variable season size.
+     * 
+     * @param nyears
+     * @param season_offsets
+     * @param nages
+     */
+    population_base(size_t nyears, const std::vector<std::vector<double> >& season_offsets, size_t nages) :
+    model_base(nyears, season_offsets, nages) {//initialize base class
+    }
+
+    /**
+     * Constructor sharing an existing calendar.
+     * 
+     * @param cal
+     */
+    explicit population_base(std::shared_ptr<const calendar> cal) :
+    model_base(cal) {//initialize base class
+    }
+
+    /**
+     * Age classes for population objects, held by the shared calendar.
+     * 
+     * @return 
+     */
+    inline const std::vector<double>& get_age_classes() const {
+        return this->calendar_->ages_;
+    }
+
+
+};
+
+/**
+ * Subpopulation partitioned by sex and area.
+ * Inherits from population_base
+ */
+class subpopulation : public population_base {
+public:
+
+    derived_quantity_view some_derived_quantities; //made up derived quantities, owned by the population store
+
+    /**
+     * Constructor for fixed season size.
+     * 
+     * @param nyears
+     * @param nseasons
+     * @param nages
+     * @param ages
+     */
+    subpopulation(size_t nyears, size_t nseasons, size_t nages, std::vector<double> ages) :
+    population_base(nyears, nseasons, nages, std::move(ages)) {//initialize base class
+    }
+
+    /**
+     * Constructor for variable season size.
+     * 
+     * @param nyears
+     * @param season_offsets
+     * @param nages
+     */
+    subpopulation(size_t nyears, const std::vector<std::vector<double> >& season_offsets, size_t nages) :
+    population_base(nyears, season_offsets, nages) {//initialize base class
+    }
+
+    /**
+     * Constructor sharing the calendar of the owning population, no
+     * season or age data is copied.
+     * 
+     * @param cal
+     */
+    explicit subpopulation(std::shared_ptr<const calendar> cal) :
+    population_base(cal) {//initialize base class
+    }
+
+    std::shared_ptr<area> area_;
+    size_t area_index_ = 0; //position of area_ in the population's areas
+    size_t dirty_year_ = 0; //first year to recompute, nyears_ when up to date
+    size_t nreplicates_ = 1; //replicates interleaved innermost in some_derived_quantities
+
+    void calculate_some_life_history_1(size_t index) {
+        //std::cout << "doing some life history stuff at index " << index << std::endl;
+        FIMS_COUNT("subpopulation::calculate_some_life_history_1", 1);
+        this->some_derived_quantities[index] = index;
+    }
+
+    /**
+     * Batched "life history stuff" for all replicates at one index, the
+     * replicates are contiguous so the loop maps onto SIMD lanes.
+     * 
+     * @param index
+     * @param parameters one value per replicate
+     */
+    void calculate_some_life_history_1(size_t index, const double* parameters) {
+        FIMS_COUNT("subpopulation::calculate_some_life_history_1", 1);
+        const size_t nreplicates = this->nreplicates_;
+        double* out = this->some_derived_quantities.data() + index * nreplicates;
+        const double value = static_cast<double> (index);
+        for (size_t r = 0; r < nreplicates; r++) {
+            out[r] = value * parameters[r];
+        }
+    }
+
+    /**
+     * Stream the derived quantities to a sink to simulate the finalization
+     * process.
+     * 
+     * @param sink
+     */
+    void finalize(fims::output_sink& sink) {
+        if (this->nreplicates_ == 1) {
+            sink.begin_partition(this->object_id, this->nyears_, this->nages_);
+            for (size_t y = 0; y < this->nyears_; y++) {
+                for (size_t s = 0; s < this->get_seasons(y); s++) {
+                    sink.write_season(y, s, this->some_derived_quantities.data() +
+                            this->get_index(y, s, 0), this->nages_);
+                }
+            }
+            sink.end_partition();
+            return;
+        }
+
+        //batched replicates are written one after another, each gathered
+        //from its lane
+        std::vector<double> row(this->nages_);
+        for (size_t r = 0; r < this->nreplicates_; r++) {
+            sink.begin_partition(this->object_id, this->nyears_, this->nages_);
+            for (size_t y = 0; y < this->nyears_; y++) {
+                for (size_t s = 0; s < this->get_seasons(y); s++) {
+                    const double* values = this->some_derived_quantities.data() +
+                            this->get_index(y, s, 0) * this->nreplicates_ + r;
+                    for (size_t a = 0; a < this->nages_; a++) {
+                        row[a] = values[a * this->nreplicates_];
+                    }
+                    sink.write_season(y, s, row.data(), this->nages_);
+                }
+            }
+            sink.end_partition();
+        }
+    }
+
+    /**
+     * Just print some stuff to simulate the finalization process.
+     */
+    void finalize() {
+        fims::text_sink sink(std::cout);
+        this->finalize(sink);
+        sink.flush();
+    }
+
+};
+
+/**
+ * Population class holds partitioned subpopulations.
+ * Inherits from population_base
+ */
+class population : public population_base {
+public:
+    std::vector<std::shared_ptr<area> > areas_;
+
+
+    //backs the subpopulations and derived quantities, reset by initialize_subpopulations
+    fims::arena arena_;
+
+    //subpopulations indexed by sex, area and any further partition axes
+    partition_table<subpopulation, fims::arena_allocator<subpopulation> > subpopulation_{
+        fims::arena_allocator<subpopulation>(&this->arena_)};
+
+    std::vector<size_t> partition_dims_; //sex, area and further partition axes
+
+    size_t nsexes_;
+
+    derived_quantity_store derived_quantities_; //owns the derived quantities of all subpopulations
+
+    std::shared_ptr<fims::thread_pool> thread_pool_; //optional, partitions are evaluated serially when empty
+
+    //with placement_ each partition has a home thread, the one that first
+    //touches and always evaluates it, see set_affinity
+    bool placement_ = false;
+    std::vector<int> thread_nodes_; //NUMA node of each pinned thread
+    std::vector<size_t> partition_owner_; //home thread of each partition
+
+    //with communicator_ this rank evaluates only the areas in
+    //[area_begin_, area_end_) and their partitions, see set_communicator
+    std::shared_ptr<fims::communicator> communicator_;
+    size_t area_begin_ = 0;
+    size_t area_end_ = 0;
+    size_t nlocal_partitions_ = 0;
+    std::vector<double> area_totals_; //boundary quantities of the last time step, one per area
+
+    /**
+     * Work done by evaulate_subpopulations, in year/season/age cells.
+     */
+    struct evaluation_stats {
+        size_t evaluated = 0; //cells recomputed
+        size_t skipped = 0; //cells that were up to date
+    };
+
+    evaluation_stats stats_; //accumulated since initialize_subpopulations or reset_stats
+
+    size_t nreplicates_ = 1; //replicates evaluated in lockstep
+    std::vector<double> replicate_parameters_ = std::vector<double>(1, 1.0); //one per replicate
+
+    /**
+     * Constructor for fixed season size.
+     * 
+     * @param nyears
+     * @param nseasons
+     * @param nages
+     * @param ages
+     */
+    population(size_t nyears, size_t nseasons, size_t nages, std::vector<double> ages) :
+    population_base(nyears, nseasons, nages, std::move(ages)) {//initialize base class
+    }
+
+    /**
+     * Constructor for variable season size.
+     * 
+     * @param nyears
+     * @param season_offsets
+     * @param nages
+     */
+    population(size_t nyears, const std::vector<std::vector<double> >& season_offsets, size_t nages) :
+    population_base(nyears, season_offsets, nages) {//initialize base class
+    }
+
+    /**
+     * Constructor sharing an existing calendar.
+     * 
+     * @param cal
+     */
+    explicit population(std::shared_ptr<const calendar> cal) :
+    population_base(cal) {//initialize base class
+    }
+
+    /**
+     * initialize subpopulations, partition by sex, area and optionally
+     * further axes such as growth morph or stock.
+     * 
+     * @param nsexes
+     * @param areas copied into the existing capacity of areas_
+     * @param axes sizes of the partition axes after sex and area
+     */
+    void initialize_subpopulations(const size_t& nsexes,
+            const std::vector<std::shared_ptr<area> >& areas,
+            const std::vector<size_t>& axes = std::vector<size_t>()) {
+        this->set_areas(areas);
+        this->build_subpopulations(nsexes, axes);
+    }
+
+    /**
+     * initialize subpopulations, taking ownership of the areas.
+     * 
+     * @param nsexes
+     * @param areas moved in
+     * @param axes sizes of the partition axes after sex and area
+     */
+    void initialize_subpopulations(const size_t& nsexes,
+            std::vector<std::shared_ptr<area> >&& areas,
+            const std::vector<size_t>& axes = std::vector<size_t>()) {
+        this->set_areas(std::move(areas));
+        this->build_subpopulations(nsexes, axes);
+    }
+
+    /**
+     * Replace areas_. A copy reuses the capacity of areas_, so rebuilding
+     * with the same areas allocates nothing.
+     * 
+     * @param areas
+     */
+    void set_areas(const std::vector<std::shared_ptr<area> >& areas) {
+        if (&areas != &this->areas_) {
+            this->areas_.assign(areas.begin(), areas.end());
+        }
+    }
+
+    void set_areas(std::vector<std::shared_ptr<area> >&& areas) {
+        this->areas_ = std::move(areas);
+    }
+
+    /**
+     * Partition areas_ by sex and axes, see initialize_subpopulations.
+     * 
+     * @param nsexes
+     * @param axes
+     */
+    void build_subpopulations(size_t nsexes, const std::vector<size_t>& axes) {
+        this->nsexes_ = nsexes;
+
+        //everything built by the previous call goes back to the arena at
+        //once, a rebuild of the same size then allocates nothing
+        this->subpopulation_.release();
+        this->derived_quantities_.release();
+        this->arena_.reset();
+
+        this->partition_dims_.clear();
+        this->partition_dims_.push_back(nsexes);
+        this->partition_dims_.push_back(this->areas_.size());
+        this->partition_dims_.insert(this->partition_dims_.end(), axes.begin(), axes.end());
+        this->subpopulation_.reset(this->partition_dims_);
+
+        size_t ninner = 1; //partitions per sex/area pair
+        for (size_t k = 0; k < axes.size(); k++) {
+            ninner *= axes[k];
+        }
+        this->derived_quantities_.resize(nsexes * this->areas_.size() * ninner,
+                this->get_size() * this->nreplicates_, &this->arena_,
+                !this->placement_ && !this->communicator_);
+        this->reset_stats();
+
+        for (size_t i = 0; i < this->nsexes_; i++) {
+            for (size_t j = 0; j < this->areas_.size(); j++) {
+                for (size_t k = 0; k < ninner; k++) {
+                    subpopulation& sub_pop = this->subpopulation_.emplace_back(this->calendar_);
+                    sub_pop.area_ = this->areas_[j];
+                    sub_pop.area_index_ = j;
+                    sub_pop.nreplicates_ = this->nreplicates_;
+                    sub_pop.some_derived_quantities =
+                            this->derived_quantities_.partition(this->subpopulation_.size() - 1);
+                }
+            }
+        }
+
+        this->assign_areas();
+        if (this->placement_) {
+            this->assign_owners();
+            this->thread_pool_->run_on_each([&](size_t t) {
+                for (size_t k = 0; k < this->partition_owner_.size(); k++) {
+                    if (this->partition_owner_[k] == t) {
+                        this->derived_quantities_.zero(k);
+                    }
+                }
+            });
+        } else if (this->communicator_) {
+            //partitions of other ranks are never touched, so their pages
+            //are never backed by memory on this node
+            for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+                if (this->is_local(k)) {
+                    this->derived_quantities_.zero(k);
+                }
+            }
+        }
+    }
+
+    /**
+     * Evaluate nreplicates copies of the model in lockstep. Each derived
+     * quantity holds the replicates contiguously, [...][age][replicate],
+     * so the innermost loop runs across replicates. Existing partitions are
+     * released, call initialize_subpopulations again. Parameters are reset
+     * to 1.
+     * 
+     * @param nreplicates
+     */
+    void set_replicates(size_t nreplicates) {
+        if (nreplicates == 0) {
+            throw std::invalid_argument("population::set_replicates: nreplicates must be positive");
+        }
+        this->subpopulation_.release();
+        this->derived_quantities_.release();
+        this->nreplicates_ = nreplicates;
+        this->replicate_parameters_.assign(nreplicates, 1.0);
+    }
+
+    /**
+     * Set the parameter of every replicate and mark all partitions dirty.
+     * 
+     * @param parameters one value per replicate
+     */
+    void set_replicate_parameters(const std::vector<double>& parameters) {
+        if (parameters.size() != this->nreplicates_) {
+            std::ostringstream os;
+            os << "population::set_replicate_parameters: " << parameters.size()
+                    << " parameters for " << this->nreplicates_ << " replicates";
+            throw std::invalid_argument(os.str());
+        }
+        this->replicate_parameters_ = parameters;
+        this->mark_dirty();
+    }
+
+    /**
+     * Set the number of threads used by evaulate_subpopulations. The pool
+     * is created here once and reused by every evaluation; 0 or 1 restores
+     * serial evaluation.
+     * 
+     * @param nthreads
+     */
+    void set_threads(size_t nthreads) {
+        if (this->placement_) {
+            //the pool may outlive this population, so do not wait for its
+            //destructor to unpin the caller
+            this->thread_pool_->unpin_caller();
+        }
+        if (nthreads > 1) {
+            this->thread_pool_ = std::make_shared<fims::thread_pool>(nthreads);
+        } else {
+            this->thread_pool_.reset();
+        }
+        this->placement_ = false;
+        this->thread_nodes_.clear();
+        this->partition_owner_.clear();
+    }
+
+    /**
+     * Evaluate on one pinned thread per entry of cpus, with NUMA aware
+     * placement: every area is given a home thread (every partition, when
+     * there are fewer areas than threads), and that thread first touches
+     * its derived quantities and evaluates them from then on, so the
+     * memory sits on the node of the CPU that uses it. Results are the
+     * same as serial evaluation.
+     * 
+     * Placement happens when pages are first touched. Existing partitions
+     * are released, call initialize_subpopulations again; memory reused
+     * from an earlier build keeps its previous placement. With
+     * FIMS_INSTRUMENTATION defined, bytes written and time per node are
+     * reported. A single cpu evaluates serially on the pinned caller. An
+     * empty cpus restores serial evaluation; that and set_threads also
+     * restore the previous affinity of the caller.
+     * 
+     * @param cpus CPU ids, thread t runs on cpus[t], the caller is thread 0
+     */
+    void set_affinity(const std::vector<int>& cpus) {
+        this->set_threads(0);
+        this->subpopulation_.release();
+        this->derived_quantities_.release();
+        if (cpus.empty()) {
+            return;
+        }
+        //not set_threads, which has no pool for one thread and so nothing
+        //to pin the caller with
+        this->thread_pool_ = std::make_shared<fims::thread_pool>(cpus.size());
+        this->thread_pool_->pin_threads(cpus);
+        this->thread_nodes_.resize(cpus.size());
+        for (size_t t = 0; t < cpus.size(); t++) {
+            this->thread_nodes_[t] = fims::thread_pool::node_of_cpu(cpus[t]);
+        }
+        this->placement_ = true;
+    }
+
+    /**
+     * Evaluate one block of areas per rank of comm. Rank r owns areas
+     * [r * nareas / size, (r + 1) * nareas / size) and all their
+     * partitions; it evaluates, zeroes (and so places in memory) and
+     * finalizes only those. Partitions of other ranks stay dirty here and
+     * are never read. After every time step of evaluate_time_forward the
+     * boundary quantities of each area are summed over the ranks, see
+     * get_area_totals, and per rank contributions to an objective are
+     * combined with reduce_sum.
+     * 
+     * Every rank must build the same model and make the same sequence of
+     * evaluate_time_forward and reduce_sum calls. Threads and placement
+     * apply within a rank. Existing partitions are released, call
+     * initialize_subpopulations again. A null comm restores evaluation of
+     * all areas.
+     * 
+     * @param comm
+     */
+    void set_communicator(std::shared_ptr<fims::communicator> comm) {
+        this->subpopulation_.release();
+        this->derived_quantities_.release();
+        this->communicator_ = comm;
+    }
+
+    /**
+     * The block of areas evaluated by this rank and the number of
+     * partitions in it.
+     */
+    void assign_areas() {
+        const size_t nareas = this->areas_.size();
+        this->area_begin_ = 0;
+        this->area_end_ = nareas;
+        if (this->communicator_) {
+            const size_t rank = this->communicator_->rank();
+            const size_t nranks = this->communicator_->size();
+            this->area_begin_ = rank * nareas / nranks;
+            this->area_end_ = (rank + 1) * nareas / nranks;
+        }
+        this->nlocal_partitions_ = 0;
+        for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+            if (this->is_local(k)) {
+                this->nlocal_partitions_++;
+            }
+        }
+        this->area_totals_.assign(nareas, 0.0);
+    }
+
+    /**
+     * True when partition k is evaluated by this rank, always without a
+     * communicator.
+     * 
+     * @param k
+     * @return 
+     */
+    inline bool is_local(size_t k) const {
+        const size_t j = this->subpopulation_[k].area_index_;
+        return j >= this->area_begin_ && j < this->area_end_;
+    }
+
+    /**
+     * Home thread of every partition of this rank: contiguous runs of
+     * areas per thread, or of partitions when there are fewer areas than
+     * threads. Partitions of other ranks have no home thread.
+     */
+    void assign_owners() {
+        const size_t nthreads = this->thread_pool_->size();
+        const size_t npartitions = this->subpopulation_.size();
+        const size_t nareas = this->area_end_ - this->area_begin_;
+        const bool by_area = nareas >= nthreads;
+        const size_t nunits = by_area ? nareas : this->nlocal_partitions_;
+        this->partition_owner_.resize(npartitions);
+        size_t local = 0;
+        for (size_t k = 0; k < npartitions; k++) {
+            if (!this->is_local(k)) {
+                this->partition_owner_[k] = static_cast<size_t> (-1);
+                continue;
+            }
+            size_t unit = by_area ? this->subpopulation_[k].area_index_ - this->area_begin_ : local;
+            this->partition_owner_[k] = unit * nthreads / nunits;
+            local++;
+        }
+    }
+
+    /**
+     * Call f(k) for every partition k of this rank: on its home thread
+     * with placement, on any pool thread with a pool, serially otherwise.
+     * f returns the number of cells it evaluated, for the per node
+     * instrumentation.
+     * 
+     * @param f
+     */
+    template <class F>
+    void for_each_partition(F f) {
+        const size_t npartitions = this->subpopulation_.size();
+        if (this->placement_) {
+            const size_t bytes_per_cell = sizeof (double) * this->nreplicates_;
+            this->thread_pool_->run_on_each([&](size_t t) {
+                FIMS_NODE_TIMER(traffic, this->thread_nodes_[t]);
+                for (size_t k = 0; k < npartitions; k++) {
+                    if (this->partition_owner_[k] == t) {
+                        size_t cells = f(k);
+                        FIMS_NODE_BYTES(traffic, cells * bytes_per_cell);
+                    }
+                }
+            });
+        } else if (this->thread_pool_) {
+            this->thread_pool_->parallel_for(npartitions, [&](size_t k) {
+                if (this->is_local(k)) {
+                    f(k);
+                }
+            });
+        } else {
+            for (size_t k = 0; k < npartitions; k++) {
+                if (this->is_local(k)) {
+                    f(k);
+                }
+            }
+        }
+    }
+
+    /**
+     * Mark every partition for recomputation from first_year on. Years are
+     * evaluated forward in time, so a change in year y invalidates y and
+     * everything after it.
+     * 
+     * @param first_year
+     */
+    void mark_dirty(size_t first_year = 0) {
+        for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+            this->mark_partition_dirty(k, first_year);
+        }
+    }
+
+    /**
+     * Mark one partition, by linear partition_table index, for
+     * recomputation from first_year on.
+     * 
+     * @param partition
+     * @param first_year
+     */
+    void mark_partition_dirty(size_t partition, size_t first_year = 0) {
+        subpopulation& sub_pop = this->subpopulation_[partition];
+        sub_pop.dirty_year_ = std::min(sub_pop.dirty_year_, first_year);
+    }
+
+    /**
+     * Mark all partitions in an area for recomputation from first_year on,
+     * e.g. after that area's parameters changed.
+     * 
+     * @param area_index
+     * @param first_year
+     */
+    void mark_area_dirty(size_t area_index, size_t first_year = 0) {
+        for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+            if (this->subpopulation_[k].area_index_ == area_index) {
+                this->mark_partition_dirty(k, first_year);
+            }
+        }
+    }
+
+    void reset_stats() {
+        this->stats_ = evaluation_stats();
+    }
+
+    /**
+     * Number of year/season/age cells from first_year to the end.
+     * 
+     * @param first_year
+     * @return 
+     */
+    inline size_t get_cells_from(size_t first_year) const {
+        const std::vector<size_t>& ids = this->calendar_->time_step_ids_;
+        return (ids[this->nyears_] - ids[first_year]) * this->nages_;
+    }
+
+    /**
+     * Evaluates "some life history stuff" for a single partition, starting
+     * at its first dirty year. Returns the number of cells evaluated.
+     * 
+     * @param sub_pop
+     * @return 
+     */
+    size_t evaluate_subpopulation(subpopulation& sub_pop) {
+        const size_t first_year = std::min(sub_pop.dirty_year_, this->nyears_);
+        const time_age_indexer<> indexer = this->get_indexer();
+        for (size_t y = first_year; y < this->nyears_; y++) {
+            for (size_t s = 0; s < indexer.get_seasons(y); s++) {
+                this->evaluate_time_step(sub_pop, indexer, y, s);
+            }
+        }
+        sub_pop.dirty_year_ = this->nyears_;
+        return this->get_cells_from(first_year);
+    }
+
+    /**
+     * Evaluates "some life history stuff" for one season of one partition.
+     * 
+     * @param sub_pop
+     * @param indexer
+     * @param year
+     * @param season
+     */
+    inline void evaluate_time_step(subpopulation& sub_pop,
+            const time_age_indexer<>& indexer, size_t year, size_t season) {
+        const size_t first = indexer.get_index(year, season, 0);
+        if (sub_pop.nreplicates_ == 1) {
+            for (size_t a = 0; a < this->nages_; a++) {
+                sub_pop.calculate_some_life_history_1(first + a);
+            }
+            return;
+        }
+        const double* parameters = this->replicate_parameters_.data();
+        for (size_t a = 0; a < this->nages_; a++) {
+            sub_pop.calculate_some_life_history_1(first + a, parameters);
+        }
+    }
+
+    /**
+     * Time-forward evaluation: loops over years and seasons, and evaluates
+     * all partitions of a time step before any partition moves on to the
+     * next one. With a thread pool the partitions of a time step run
+     * concurrently, and parallel_for returning is the barrier between
+     * steps. After each step, between(year, season) is called on the
+     * calling thread with every partition up to date through that step.
+     * That is where exchanges between areas, such as movement, belong.
+     * 
+     * Dirty tracking is honored per partition. If between() couples the
+     * partitions, a change in one partition affects the others, so mark
+     * all of them with mark_dirty(first_year).
+     * 
+     * With a communicator each rank evaluates its own areas, and before
+     * between(year, season) the area totals of the step are exchanged, so
+     * get_area_totals() is complete and the same on every rank there.
+     * Movement or catch that couple areas are computed from those totals
+     * rather than from other ranks' partitions. The ranks agree on the
+     * first dirty year before the loop, so every rank takes part in the
+     * same exchanges even when only some of them have dirty partitions.
+     * 
+     * @param between
+     */
+    template <class F>
+    void evaluate_time_forward(F between) {
+        FIMS_SCOPED_TIMER("population::evaluate_time_forward");
+        const size_t npartitions = this->subpopulation_.size();
+        const time_age_indexer<> indexer = this->get_indexer();
+
+        size_t first_year = this->nyears_;
+        for (size_t k = 0; k < npartitions; k++) {
+            if (this->is_local(k)) {
+                first_year = std::min(first_year, this->subpopulation_[k].dirty_year_);
+            }
+        }
+        if (this->communicator_) {
+            first_year = this->communicator_->allreduce_min(first_year);
+        }
+
+        size_t evaluated = 0;
+        for (size_t y = first_year; y < this->nyears_; y++) {
+            for (size_t s = 0; s < indexer.get_seasons(y); s++) {
+                this->for_each_partition([&](size_t k) -> size_t {
+                    subpopulation& sub_pop = this->subpopulation_[k];
+                    if (sub_pop.dirty_year_ <= y) {
+                        FIMS_PARTITION_TIMER(k);
+                        this->evaluate_time_step(sub_pop, indexer, y, s);
+                        return this->nages_;
+                    }
+                    return 0;
+                });
+                if (this->communicator_) {
+                    this->exchange_area_totals(indexer, y, s);
+                }
+                between(y, s);
+            }
+        }
+
+        for (size_t k = 0; k < npartitions; k++) {
+            subpopulation& sub_pop = this->subpopulation_[k];
+            if (this->is_local(k) && sub_pop.dirty_year_ < this->nyears_) {
+                evaluated += this->get_cells_from(sub_pop.dirty_year_);
+                sub_pop.dirty_year_ = this->nyears_;
+            }
+        }
+        this->stats_.evaluated += evaluated;
+        this->stats_.skipped += this->nlocal_partitions_ * this->get_cells_from(0) - evaluated;
+    }
+
+    /**
+     * Sum of the derived quantities of each area over its partitions, ages
+     * and replicates in one season, then over the ranks. Only the nareas
+     * totals travel between ranks.
+     * 
+     * @param indexer
+     * @param year
+     * @param season
+     */
+    void exchange_area_totals(const time_age_indexer<>& indexer, size_t year, size_t season) {
+        FIMS_SCOPED_TIMER("population::exchange_area_totals");
+        std::fill(this->area_totals_.begin(), this->area_totals_.end(), 0.0);
+        const size_t first = indexer.get_index(year, season, 0) * this->nreplicates_;
+        const size_t n = this->nages_ * this->nreplicates_;
+        for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+            if (this->is_local(k)) {
+                const subpopulation& sub_pop = this->subpopulation_[k];
+                const double* values = sub_pop.some_derived_quantities.data() + first;
+                double total = 0.0;
+                for (size_t i = 0; i < n; i++) {
+                    total += values[i];
+                }
+                this->area_totals_[sub_pop.area_index_] += total;
+            }
+        }
+        this->communicator_->allreduce_sum(this->area_totals_.data(), this->area_totals_.size());
+    }
+
+    /**
+     * Totals of every area in the last time step exchanged by
+     * evaluate_time_forward, valid inside between() with a communicator.
+     * 
+     * @return 
+     */
+    inline const std::vector<double>& get_area_totals() const {
+        return this->area_totals_;
+    }
+
+    /**
+     * Sum of this rank's contribution to an objective, e.g. its areas'
+     * negative log likelihood, over all ranks. Without a communicator the
+     * value is returned as is.
+     * 
+     * @param local
+     * @return 
+     */
+    double reduce_sum(double local) {
+        if (this->communicator_) {
+            this->communicator_->allreduce_sum(&local, 1);
+        }
+        return local;
+    }
+
+    /**
+     * Time-forward evaluation without exchanges between time steps.
+     */
+    void evaluate_time_forward() {
+        this->evaluate_time_forward([](size_t, size_t) {
+        });
+    }
+
+    /**
+     * Loops through sex/area partitions and evaluates "some life history stuff"
+     * based on modeling time step. Only partitions and years marked dirty
+     * since the last call are recomputed, the rest are counted in
+     * stats_.skipped. When a thread pool is set the partitions are evaluated
+     * concurrently; each one writes only to its own block of the store, so
+     * results do not depend on the number of threads.
+     * 
+     */
+    void evaulate_subpopulations() {
+        FIMS_SCOPED_TIMER("population::evaulate_subpopulations");
+        const size_t total = this->nlocal_partitions_ * this->get_cells_from(0);
+        size_t evaluated = 0;
+
+        std::atomic<size_t> count(0);
+        this->for_each_partition([&](size_t k) -> size_t {
+            if (this->subpopulation_[k].dirty_year_ < this->nyears_) {
+                FIMS_PARTITION_TIMER(k);
+                size_t cells = this->evaluate_subpopulation(this->subpopulation_[k]);
+                count.fetch_add(cells, std::memory_order_relaxed);
+                return cells;
+            }
+            return 0;
+        });
+        evaluated = count.load();
+
+        this->stats_.evaluated += evaluated;
+        this->stats_.skipped += total - evaluated;
+    }
+
+    /**
+     * Copy of the evaluated state for a checkpoint: calendar, partition
+     * layout, dirty years, replicate parameters and derived quantities.
+     * 
+     * @return 
+     */
+    fims::snapshot_data snapshot() const {
+        fims::snapshot_data ret;
+        const calendar& cal = *this->calendar_;
+        ret.nyears = cal.nyears_;
+        ret.nages = cal.nages_;
+        ret.layout = static_cast<uint64_t> (cal.layout_);
+        ret.nreplicates = this->nreplicates_;
+        ret.partition_size = this->derived_quantities_.partition_size_;
+        ret.partition_stride = this->derived_quantities_.partition_stride_;
+        ret.nseasons.assign(cal.nseasons_.begin(), cal.nseasons_.end());
+        ret.season_offsets = cal.season_offsets_;
+        ret.ages = cal.ages_;
+        ret.dims.assign(this->partition_dims_.begin(), this->partition_dims_.end());
+        ret.area_index.resize(this->subpopulation_.size());
+        ret.dirty_year.resize(this->subpopulation_.size());
+        for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+            ret.area_index[k] = this->subpopulation_[k].area_index_;
+            ret.dirty_year[k] = this->subpopulation_[k].dirty_year_;
+        }
+        ret.replicate_parameters = this->replicate_parameters_;
+        ret.values.assign(this->derived_quantities_.data(),
+                this->derived_quantities_.data() + this->derived_quantities_.size());
+        return ret;
+    }
+
+    /**
+     * Write a checkpoint to path, see fims_snapshot.hpp.
+     * 
+     * @param path
+     */
+    void write_snapshot(const std::string& path) const {
+        FIMS_SCOPED_TIMER("population::write_snapshot");
+        fims::write_snapshot(path, this->snapshot());
+    }
+
+    /**
+     * Copy the state and write it to path on the writer's background
+     * thread. Evaluation may continue as soon as this returns.
+     * 
+     * @param writer
+     * @param path
+     */
+    void write_snapshot(fims::async_snapshot_writer& writer, const std::string& path) const {
+        FIMS_SCOPED_TIMER("population::write_snapshot async");
+        writer.start(path, this->snapshot());
+    }
+
+    /**
+     * Restore a checkpoint. The calendar and partitions are rebuilt from
+     * the snapshot, the derived quantities are used in place from the
+     * mapping, so no buffer is read or copied up front. Partitions resume
+     * with their saved dirty years: a resumed run evaluates nothing that
+     * was up to date, and a retrospective peel calls mark_dirty(first_year)
+     * and recomputes only the years after the shared prefix.
+     * 
+     * @param snapshot held by the population until the next rebuild
+     * @param areas one per area of the snapshot, or empty to create areas
+     * sharing the restored calendar
+     */
+    void restore(std::shared_ptr<const fims::mapped_snapshot> snapshot,
+            const std::vector<std::shared_ptr<area> >& areas = std::vector<std::shared_ptr<area> >()) {
+        this->restore_snapshot(std::move(snapshot), areas);
+    }
+
+    /**
+     * Restore a checkpoint, taking ownership of the areas.
+     * 
+     * @param snapshot
+     * @param areas moved in
+     */
+    void restore(std::shared_ptr<const fims::mapped_snapshot> snapshot,
+            std::vector<std::shared_ptr<area> >&& areas) {
+        this->restore_snapshot(std::move(snapshot), std::move(areas));
+    }
+
+    /**
+     * Shared by both restore overloads, areas is forwarded to set_areas
+     * once the snapshot has been validated.
+     */
+    template <class Areas>
+    void restore_snapshot(std::shared_ptr<const fims::mapped_snapshot> snapshot, Areas&& areas) {
+        FIMS_SCOPED_TIMER("population::restore");
+        const fims::snapshot_view& v = snapshot->view();
+        if (v.ndims < 2) {
+            throw std::invalid_argument("population::restore: bad partition layout in snapshot");
+        }
+        //the product must match npartitions without overflowing on the way
+        size_t npartitions = 1;
+        for (size_t i = 0; i < v.ndims; i++) {
+            if (v.dims[i] != 0 && npartitions > SIZE_MAX / v.dims[i]) {
+                throw std::invalid_argument("population::restore: bad partition layout in snapshot");
+            }
+            npartitions *= v.dims[i];
+        }
+        if (npartitions != v.npartitions || v.nreplicates == 0 ||
+                v.layout > static_cast<uint64_t> (index_layout::ragged)) {
+            throw std::invalid_argument("population::restore: bad partition layout in snapshot");
+        }
+        const size_t nareas = v.dims[1];
+        if (!areas.empty() && areas.size() != nareas) {
+            std::ostringstream os;
+            os << "population::restore: " << areas.size() << " areas for a snapshot with " << nareas;
+            throw std::invalid_argument(os.str());
+        }
+        for (size_t k = 0; k < npartitions; k++) {
+            if (v.area_index[k] >= nareas) {
+                throw std::invalid_argument("population::restore: bad area index in snapshot");
+            }
+        }
+
+        std::shared_ptr<const calendar> cal = std::make_shared<const calendar>(
+                std::vector<size_t>(v.nseasons, v.nseasons + v.nyears),
+                std::vector<double>(v.season_offsets, v.season_offsets + v.nseason_offsets),
+                v.nages, static_cast<index_layout> (v.layout),
+                std::vector<double>(v.ages, v.ages + v.nage_classes));
+        if (cal->get_size() * v.nreplicates != v.partition_size) {
+            throw std::invalid_argument("population::restore: partition size does not match the calendar");
+        }
+        if (!derived_quantity_store::can_adopt(v.values, v.partition_size, v.partition_stride)) {
+            throw std::invalid_argument("population::restore: incompatible partition layout in snapshot");
+        }
+
+        //everything is validated, nothing below throws for a bad snapshot
+        this->subpopulation_.release();
+        this->derived_quantities_.release();
+        this->arena_.reset();
+
+        this->set_calendar(cal);
+        this->nreplicates_ = v.nreplicates;
+        this->replicate_parameters_.assign(v.replicate_parameters,
+                v.replicate_parameters + v.nreplicates);
+        this->nsexes_ = v.dims[0];
+        const bool create_areas = areas.empty();
+        this->set_areas(std::forward<Areas>(areas));
+        if (create_areas) {
+            for (size_t j = 0; j < nareas; j++) {
+                this->areas_.push_back(std::make_shared<area>(cal));
+            }
+        }
+        this->partition_dims_.assign(v.dims, v.dims + v.ndims);
+        this->subpopulation_.reset(this->partition_dims_);
+        this->derived_quantities_.adopt(v.values, v.npartitions, v.partition_size,
+                v.partition_stride, snapshot);
+        this->reset_stats();
+
+        for (size_t k = 0; k < npartitions; k++) {
+            subpopulation& sub_pop = this->subpopulation_.emplace_back(this->calendar_);
+            sub_pop.area_ = this->areas_[v.area_index[k]];
+            sub_pop.area_index_ = v.area_index[k];
+            sub_pop.nreplicates_ = this->nreplicates_;
+            sub_pop.dirty_year_ = std::min<size_t>(v.dirty_year[k], this->nyears_);
+            sub_pop.some_derived_quantities = this->derived_quantities_.partition(k);
+        }
+        this->assign_areas();
+        if (this->placement_) {
+            this->assign_owners();
+        }
+    }
+
+    /**
+     * Loops through sex/area partitions of this rank and streams each one
+     * to sink. Probes are not reported here, the driver calls
+     * FIMS_INSTRUMENTATION_REPORT once, on one rank, when it is done.
+     * 
+     * @param sink
+     */
+    void finalize(fims::output_sink& sink) {
+        FIMS_SCOPED_TIMER("population::finalize");
+        for (size_t k = 0; k < this->subpopulation_.size(); k++) {
+            if (this->is_local(k)) {
+                this->subpopulation_[k].finalize(sink);
+            }
+        }
+        sink.flush();
+    }
+
+    /**
+     * Loops through sex/area partitions and prints them to std::cout.
+     */
+    void finalize() {
+        fims::text_sink sink(std::cout);
+        this->finalize(sink);
+    }
+};
+
+#endif /* FIMS_INDEXING_HPP */
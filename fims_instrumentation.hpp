@@ -0,0 +1,327 @@
+/*! \file fims_instrumentation.hpp
+ */
+
+/*
+ * File:   fims_instrumentation.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * Optional hot path instrumentation: scoped timers, call counters and per
+ * partition elapsed time. Everything is compiled in only when
+ * FIMS_INSTRUMENTATION is defined; otherwise the macros below expand to
+ * nothing and the probes cost nothing.
+ *
+ *   FIMS_SCOPED_TIMER("name")        time the enclosing scope
+ *   FIMS_COUNT("name", n)            add n to a counter
+ *   FIMS_PARTITION_TIMER(k)          time the enclosing scope for partition k
+ *   FIMS_NODE_TIMER(t, node)         time the enclosing scope as timer t on a
+ *                                    NUMA node
+ *   FIMS_NODE_BYTES(t, n)            add n bytes moved to node timer t
+ *   FIMS_INSTRUMENTATION_REPORT(os)  print the aggregated results
+ *   FIMS_INSTRUMENTATION_RESET()     clear all results
+ *
+ * Probes record into thread-local buffers without locking. The report
+ * merges the buffers of all threads and of threads that have exited, it
+ * must not run concurrently with instrumented code.
+ *
+ */
+#ifndef FIMS_INSTRUMENTATION_HPP
+#define FIMS_INSTRUMENTATION_HPP
+
+#ifdef FIMS_INSTRUMENTATION
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace fims {
+namespace instrumentation {
+
+typedef std::chrono::steady_clock clock;
+
+/**
+ * @brief Accumulated calls and wall time of one probe.
+ */
+struct probe {
+    size_t calls = 0;
+    double ns = 0.0; //0 for counters
+};
+
+/**
+ * @brief Merge src into dst, growing dst as needed.
+ */
+inline void merge(std::vector<probe>& dst, const std::vector<probe>& src) {
+    if (dst.size() < src.size()) {
+        dst.resize(src.size());
+    }
+    for (size_t i = 0; i < src.size(); i++) {
+        dst[i].calls += src[i].calls;
+        dst[i].ns += src[i].ns;
+    }
+}
+
+struct thread_buffer;
+
+/**
+ * @brief Process wide table of probe names and thread buffers.
+ */
+class registry {
+public:
+    std::mutex mutex_;
+    std::vector<std::string> names_;
+    std::vector<thread_buffer*> buffers_; //live threads
+    std::vector<probe> retired_probes_; //from threads that have exited
+    std::vector<probe> retired_partitions_;
+    std::vector<probe> retired_nodes_;
+
+    static registry& instance() {
+        static registry r;
+        return r;
+    }
+
+    /**
+     * @brief Return the id of a probe, creating it on first use. Probes
+     * with the same name share an id.
+     */
+    size_t add_probe(const char* name) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (size_t i = 0; i < this->names_.size(); i++) {
+            if (this->names_[i] == name) {
+                return i;
+            }
+        }
+        this->names_.push_back(name);
+        return this->names_.size() - 1;
+    }
+};
+
+/**
+ * @brief Per thread results, folded into the registry when the thread
+ * exits.
+ */
+struct thread_buffer {
+    std::vector<probe> probes;
+    std::vector<probe> partitions;
+    std::vector<probe> nodes; //calls holds bytes moved
+
+    thread_buffer() {
+        registry& r = registry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex_);
+        r.buffers_.push_back(this);
+    }
+
+    ~thread_buffer() {
+        registry& r = registry::instance();
+        std::lock_guard<std::mutex> lock(r.mutex_);
+        merge(r.retired_probes_, this->probes);
+        merge(r.retired_partitions_, this->partitions);
+        merge(r.retired_nodes_, this->nodes);
+        r.buffers_.erase(std::remove(r.buffers_.begin(), r.buffers_.end(), this),
+                r.buffers_.end());
+    }
+};
+
+inline thread_buffer& local() {
+    thread_local thread_buffer buffer;
+    return buffer;
+}
+
+inline probe& slot(std::vector<probe>& probes, size_t id) {
+    if (probes.size() <= id) {
+        probes.resize(id + 1);
+    }
+    return probes[id];
+}
+
+inline void count(size_t id, size_t n) {
+    slot(local().probes, id).calls += n;
+}
+
+/**
+ * @brief Records the lifetime of the object as one call of a probe.
+ */
+class scoped_timer {
+    size_t id_; //not a reference, nested probes may grow the buffer
+    clock::time_point start_;
+public:
+
+    explicit scoped_timer(size_t id) : id_(id), start_(clock::now()) {
+    }
+
+    ~scoped_timer() {
+        probe& p = slot(local().probes, this->id_);
+        p.calls++;
+        p.ns += std::chrono::duration<double, std::nano>(clock::now() - this->start_).count();
+    }
+};
+
+/**
+ * @brief Records the lifetime of the object as one call of partition k.
+ */
+class partition_timer {
+    size_t partition_;
+    clock::time_point start_;
+public:
+
+    explicit partition_timer(size_t partition) : partition_(partition),
+    start_(clock::now()) {
+    }
+
+    ~partition_timer() {
+        probe& p = slot(local().partitions, this->partition_);
+        p.calls++;
+        p.ns += std::chrono::duration<double, std::nano>(clock::now() - this->start_).count();
+    }
+};
+
+/**
+ * @brief Records the lifetime of the object and the bytes added to it
+ * against a NUMA node, for per node bandwidth.
+ */
+class node_timer {
+    size_t node_;
+    size_t bytes_;
+    clock::time_point start_;
+public:
+
+    explicit node_timer(int node) : node_(node < 0 ? 0 : static_cast<size_t> (node)),
+    bytes_(0), start_(clock::now()) {
+    }
+
+    inline void add(size_t bytes) {
+        this->bytes_ += bytes;
+    }
+
+    ~node_timer() {
+        probe& p = slot(local().nodes, this->node_);
+        p.calls += this->bytes_;
+        p.ns += std::chrono::duration<double, std::nano>(clock::now() - this->start_).count();
+    }
+};
+
+/**
+ * @brief Results merged over all threads.
+ */
+struct summary {
+    std::vector<std::string> names;
+    std::vector<probe> probes; //indexed like names
+    std::vector<probe> partitions; //indexed by partition
+    std::vector<probe> nodes; //indexed by NUMA node, calls holds bytes
+};
+
+inline summary collect() {
+    registry& r = registry::instance();
+    std::lock_guard<std::mutex> lock(r.mutex_);
+    summary ret;
+    ret.names = r.names_;
+    ret.probes = r.retired_probes_;
+    ret.partitions = r.retired_partitions_;
+    ret.nodes = r.retired_nodes_;
+    for (size_t i = 0; i < r.buffers_.size(); i++) {
+        merge(ret.probes, r.buffers_[i]->probes);
+        merge(ret.partitions, r.buffers_[i]->partitions);
+        merge(ret.nodes, r.buffers_[i]->nodes);
+    }
+    ret.probes.resize(ret.names.size());
+    return ret;
+}
+
+inline void reset() {
+    registry& r = registry::instance();
+    std::lock_guard<std::mutex> lock(r.mutex_);
+    r.retired_probes_.clear();
+    r.retired_partitions_.clear();
+    r.retired_nodes_.clear();
+    for (size_t i = 0; i < r.buffers_.size(); i++) {
+        r.buffers_[i]->probes.assign(r.buffers_[i]->probes.size(), probe());
+        r.buffers_[i]->partitions.assign(r.buffers_[i]->partitions.size(), probe());
+        r.buffers_[i]->nodes.assign(r.buffers_[i]->nodes.size(), probe());
+    }
+}
+
+inline void report(std::ostream& os) {
+    summary s = collect();
+    os << std::left << std::setw(40) << "probe" << std::right << std::setw(14) << "calls"
+            << std::setw(16) << "total ms" << std::setw(14) << "ns/call" << "\n";
+    for (size_t i = 0; i < s.names.size(); i++) {
+        const probe& p = s.probes[i];
+        os << std::left << std::setw(40) << s.names[i] << std::right << std::setw(14) << p.calls;
+        if (p.ns > 0.0) {
+            os << std::setw(16) << std::fixed << std::setprecision(3) << p.ns * 1e-6
+                    << std::setw(14) << std::setprecision(1) << p.ns / p.calls;
+            os.unsetf(std::ios::floatfield);
+        }
+        os << "\n";
+    }
+    for (size_t k = 0; k < s.partitions.size(); k++) {
+        const probe& p = s.partitions[k];
+        if (p.calls > 0) {
+            os << std::left << std::setw(40) << ("partition " + std::to_string(k)) << std::right
+                    << std::setw(14) << p.calls << std::setw(16) << std::fixed << std::setprecision(3)
+                    << p.ns * 1e-6 << std::setw(14) << std::setprecision(1) << p.ns / p.calls << "\n";
+            os.unsetf(std::ios::floatfield);
+        }
+    }
+    //bytes over summed thread time, the bandwidth seen by one thread
+    for (size_t n = 0; n < s.nodes.size(); n++) {
+        const probe& p = s.nodes[n];
+        if (p.ns > 0.0) {
+            os << std::left << std::setw(40) << ("node " + std::to_string(n) + " MB, ms, GB/s/thread")
+                    << std::right << std::fixed << std::setprecision(1) << std::setw(14) << p.calls * 1e-6
+                    << std::setw(16) << std::setprecision(3) << p.ns * 1e-6
+                    << std::setw(14) << std::setprecision(2) << p.calls / p.ns << "\n";
+            os.unsetf(std::ios::floatfield);
+        }
+    }
+    os << std::setprecision(6);
+}
+
+}  // namespace instrumentation
+}  // namespace fims
+
+#define FIMS_INSTRUMENTATION_CONCAT2(a, b) a##b
+#define FIMS_INSTRUMENTATION_CONCAT(a, b) FIMS_INSTRUMENTATION_CONCAT2(a, b)
+#define FIMS_INSTRUMENTATION_ID(prefix) FIMS_INSTRUMENTATION_CONCAT(prefix, __LINE__)
+
+#define FIMS_SCOPED_TIMER(name) \
+    static const size_t FIMS_INSTRUMENTATION_ID(fims_probe_) = \
+        ::fims::instrumentation::registry::instance().add_probe(name); \
+    ::fims::instrumentation::scoped_timer FIMS_INSTRUMENTATION_ID(fims_timer_)( \
+        FIMS_INSTRUMENTATION_ID(fims_probe_))
+
+#define FIMS_COUNT(name, n) \
+    do { \
+        static const size_t fims_probe = \
+            ::fims::instrumentation::registry::instance().add_probe(name); \
+        ::fims::instrumentation::count(fims_probe, (n)); \
+    } while (0)
+
+#define FIMS_PARTITION_TIMER(k) \
+    ::fims::instrumentation::partition_timer FIMS_INSTRUMENTATION_ID(fims_partition_timer_)(k)
+
+#define FIMS_NODE_TIMER(t, node) ::fims::instrumentation::node_timer t(node)
+#define FIMS_NODE_BYTES(t, n) t.add(n)
+
+#define FIMS_INSTRUMENTATION_REPORT(os) ::fims::instrumentation::report(os)
+#define FIMS_INSTRUMENTATION_RESET() ::fims::instrumentation::reset()
+
+#else
+
+#define FIMS_SCOPED_TIMER(name)
+#define FIMS_COUNT(name, n) do { } while (0)
+#define FIMS_PARTITION_TIMER(k)
+#define FIMS_NODE_TIMER(t, node)
+#define FIMS_NODE_BYTES(t, n) do { (void) (n); } while (0)
+#define FIMS_INSTRUMENTATION_REPORT(os)
+#define FIMS_INSTRUMENTATION_RESET()
+
+#endif /* FIMS_INSTRUMENTATION */
+
+#endif /* FIMS_INSTRUMENTATION_HPP */
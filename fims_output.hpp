@@ -0,0 +1,185 @@
+/*! \file fims_output.hpp
+ */
+
+/*
+ * File:   fims_output.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * Output sinks for derived quantities. Partitions are streamed to a sink
+ * one season row at a time, so the caller never materializes formatted
+ * output. text_sink reproduces the human readable report; binary_sink
+ * writes one columnar chunk per partition.
+ *
+ */
+#ifndef FIMS_OUTPUT_HPP
+#define FIMS_OUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fims {
+
+/**
+ * @brief Destination for derived quantities.
+ *
+ * A partition is written as begin_partition, one write_season call per
+ * season in time order, then end_partition.
+ */
+class output_sink {
+public:
+
+    virtual ~output_sink() {
+    }
+
+    virtual void begin_partition(size_t object_id, size_t nyears, size_t nages) = 0;
+
+    /**
+     * @brief Write the values of all ages in one season.
+     */
+    virtual void write_season(size_t year, size_t season, const double* values,
+            size_t nages) = 0;
+
+    virtual void end_partition() = 0;
+
+    virtual void flush() {
+    }
+};
+
+/**
+ * @brief Human readable report, one line per season.
+ *
+ * Lines end with '\n' rather than std::endl, so the stream is flushed only
+ * by flush() or by its own buffering.
+ */
+class text_sink : public output_sink {
+    std::ostream& os_;
+    size_t object_id_;
+public:
+
+    explicit text_sink(std::ostream& os) : os_(os), object_id_(0) {
+    }
+
+    void begin_partition(size_t object_id, size_t /*nyears*/, size_t /*nages*/) {
+        this->object_id_ = object_id;
+        this->os_ << "subpopulation " << object_id << "\n\n";
+    }
+
+    void write_season(size_t year, size_t season, const double* values, size_t nages) {
+        this->os_ << "subpopulation " << this->object_id_ << " " << "year " << year
+                << " " << "season " << season << "\n";
+        for (size_t a = 0; a < nages; a++) {
+            this->os_ << values[a] << "  ";
+        }
+        this->os_ << '\n';
+    }
+
+    void end_partition() {
+        this->os_ << '\n';
+    }
+
+    void flush() {
+        this->os_.flush();
+    }
+};
+
+/**
+ * @brief Buffered binary writer, one columnar chunk per partition.
+ *
+ * File layout, all integers little endian as written by the host:
+ *
+ *   char[8]  magic "FIMSDQ01"
+ *   chunks, each
+ *     uint64 object_id, nyears, nages, nrows
+ *     uint32 year[nrows]
+ *     uint32 season[nrows]
+ *     double value[nrows * nages]   row major, age fastest
+ *
+ * Rows of the current partition are staged in reusable buffers and written
+ * with one fwrite per column when the partition ends.
+ */
+class binary_sink : public output_sink {
+    std::FILE* file_;
+    std::vector<char> buffer_; //stdio buffer
+    uint64_t header_[4];
+    std::vector<uint32_t> years_;
+    std::vector<uint32_t> seasons_;
+    std::vector<double> values_;
+
+    void write(const void* p, size_t size) {
+        if (size > 0 && std::fwrite(p, 1, size, this->file_) != size) {
+            throw std::runtime_error("binary_sink: write failed");
+        }
+    }
+
+public:
+
+    /**
+     * @brief Open path for writing, truncating it.
+     *
+     * @param path
+     * @param buffer_size stdio buffer size in bytes
+     */
+    explicit binary_sink(const std::string& path, size_t buffer_size = 1 << 20) :
+    buffer_(buffer_size) {
+        this->file_ = std::fopen(path.c_str(), "wb");
+        if (this->file_ == NULL) {
+            throw std::runtime_error("binary_sink: unable to open " + path);
+        }
+        std::setvbuf(this->file_, this->buffer_.data(), _IOFBF, this->buffer_.size());
+        try {
+            this->write("FIMSDQ01", 8);
+        } catch (...) {
+            //the destructor does not run for a constructor that throws
+            std::fclose(this->file_);
+            throw;
+        }
+    }
+
+    binary_sink(const binary_sink&) = delete;
+    binary_sink& operator=(const binary_sink&) = delete;
+
+    ~binary_sink() {
+        std::fclose(this->file_);
+    }
+
+    void begin_partition(size_t object_id, size_t nyears, size_t nages) {
+        this->header_[0] = object_id;
+        this->header_[1] = nyears;
+        this->header_[2] = nages;
+        this->years_.clear();
+        this->seasons_.clear();
+        this->values_.clear();
+    }
+
+    void write_season(size_t year, size_t season, const double* values, size_t nages) {
+        this->years_.push_back(static_cast<uint32_t> (year));
+        this->seasons_.push_back(static_cast<uint32_t> (season));
+        this->values_.insert(this->values_.end(), values, values + nages);
+    }
+
+    void end_partition() {
+        this->header_[3] = this->years_.size();
+        this->write(this->header_, sizeof (this->header_));
+        this->write(this->years_.data(), this->years_.size() * sizeof (uint32_t));
+        this->write(this->seasons_.data(), this->seasons_.size() * sizeof (uint32_t));
+        this->write(this->values_.data(), this->values_.size() * sizeof (double));
+    }
+
+    void flush() {
+        if (std::fflush(this->file_) != 0) {
+            throw std::runtime_error("binary_sink: flush failed");
+        }
+    }
+};
+
+}  // namespace fims
+
+#endif /* FIMS_OUTPUT_HPP */
@@ -0,0 +1,205 @@
+/*! \file fims_ragged_file.hpp
+ */
+
+/*
+ * File:   fims_ragged_file.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * Compact binary files of ragged rows, such as per-year season offsets or
+ * data time snapshots, and a zero-copy view over a memory-mapped file.
+ *
+ * File layout, all values as written by the host:
+ *
+ *   char[8]  magic "FIMSRG01"
+ *   uint64   nrows
+ *   uint64   nvalues
+ *   uint64   row_starts[nrows + 1]   row i is values[row_starts[i], row_starts[i + 1])
+ *   double   values[nvalues]
+ *
+ */
+#ifndef FIMS_RAGGED_FILE_HPP
+#define FIMS_RAGGED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fims {
+
+/**
+ * @brief Non-owning view of ragged rows of doubles in CSR form.
+ */
+struct ragged_view {
+    const uint64_t* row_starts; //nrows + 1 entries
+    const double* values;
+    size_t nrows;
+
+    inline size_t size() const {
+        return this->nrows;
+    }
+
+    inline size_t row_size(const size_t& i) const {
+        return static_cast<size_t> (this->row_starts[i + 1] - this->row_starts[i]);
+    }
+
+    inline const double* row(const size_t& i) const {
+        return this->values + this->row_starts[i];
+    }
+
+    inline const double* row_end(const size_t& i) const {
+        return this->values + this->row_starts[i + 1];
+    }
+};
+
+/**
+ * @brief Read-only memory mapping of a ragged file.
+ *
+ * The view returned by view() points into the mapping and is valid for
+ * the lifetime of this object.
+ */
+class mapped_ragged_file {
+    void* map_;
+    size_t length_;
+    ragged_view view_;
+
+    static void fail(const std::string& path, const char* what) {
+        throw std::runtime_error("mapped_ragged_file: " + path + ": " + what);
+    }
+
+public:
+
+    explicit mapped_ragged_file(const std::string& path) : map_(MAP_FAILED), length_(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fail(path, "unable to open");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            fail(path, "unable to stat");
+        }
+        this->length_ = static_cast<size_t> (st.st_size);
+        if (this->length_ < 24) {
+            close(fd);
+            fail(path, "truncated header");
+        }
+        this->map_ = mmap(NULL, this->length_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (this->map_ == MAP_FAILED) {
+            fail(path, "mmap failed");
+        }
+
+        const char* p = static_cast<const char*> (this->map_);
+        uint64_t header[2];
+        std::memcpy(header, p + 8, sizeof (header));
+        if (std::memcmp(p, "FIMSRG01", 8) != 0) {
+            munmap(this->map_, this->length_);
+            fail(path, "bad magic");
+        }
+        //compare in units of elements so corrupt sizes cannot overflow
+        const uint64_t words = (this->length_ - 24) / 8;
+        if (header[0] >= words || header[1] > words - header[0] - 1 ||
+                24 + 8 * (header[0] + 1 + header[1]) != this->length_) {
+            munmap(this->map_, this->length_);
+            fail(path, "size mismatch");
+        }
+        this->view_.nrows = static_cast<size_t> (header[0]);
+        this->view_.row_starts = reinterpret_cast<const uint64_t*> (p + 24);
+        this->view_.values = reinterpret_cast<const double*> (p + 24 + 8 * (header[0] + 1));
+        if (this->view_.row_starts[0] != 0 || this->view_.row_starts[header[0]] != header[1]) {
+            munmap(this->map_, this->length_);
+            fail(path, "bad row starts");
+        }
+        for (size_t i = 0; i < this->view_.nrows; i++) {
+            if (this->view_.row_starts[i + 1] < this->view_.row_starts[i]) {
+                munmap(this->map_, this->length_);
+                fail(path, "bad row starts");
+            }
+        }
+    }
+
+    mapped_ragged_file(const mapped_ragged_file&) = delete;
+    mapped_ragged_file& operator=(const mapped_ragged_file&) = delete;
+
+    ~mapped_ragged_file() {
+        munmap(this->map_, this->length_);
+    }
+
+    inline const ragged_view& view() const {
+        return this->view_;
+    }
+};
+
+/**
+ * @brief Write rows to path in the ragged file format.
+ *
+ * @param path
+ * @param rows
+ */
+inline void write_ragged_file(const std::string& path,
+        const std::vector<std::vector<double> >& rows) {
+    std::vector<uint64_t> row_starts(rows.size() + 1, 0);
+    for (size_t i = 0; i < rows.size(); i++) {
+        row_starts[i + 1] = row_starts[i] + rows[i].size();
+    }
+    const uint64_t header[2] = {rows.size(), row_starts[rows.size()]};
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        throw std::runtime_error("write_ragged_file: unable to open " + path);
+    }
+    bool ok = std::fwrite("FIMSRG01", 1, 8, file) == 8;
+    ok = ok && std::fwrite(header, 8, 2, file) == 2;
+    ok = ok && std::fwrite(row_starts.data(), 8, row_starts.size(), file) == row_starts.size();
+    for (size_t i = 0; ok && i < rows.size(); i++) {
+        ok = std::fwrite(rows[i].data(), 8, rows[i].size(), file) == rows[i].size();
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        throw std::runtime_error("write_ragged_file: write failed for " + path);
+    }
+}
+
+/**
+ * @brief Write a data time snapshot to path, one row per year in key
+ * order.
+ *
+ * The file stores no keys, row i is read back as year i, so the years
+ * must be 0 to n - 1 without gaps; other maps throw
+ * std::invalid_argument.
+ *
+ * @param path
+ * @param snapshot
+ */
+inline void write_ragged_file(const std::string& path,
+        const std::map<uint32_t, std::vector<double> >& snapshot) {
+    std::vector<std::vector<double> > rows;
+    rows.reserve(snapshot.size());
+    for (std::map<uint32_t, std::vector<double> >::const_iterator it = snapshot.begin();
+            it != snapshot.end(); ++it) {
+        if (it->first != rows.size()) {
+            throw std::invalid_argument("write_ragged_file: years of " + path +
+                    " must run from 0 without gaps, found year " + std::to_string(it->first) +
+                    " at row " + std::to_string(rows.size()));
+        }
+        rows.push_back(it->second);
+    }
+    write_ragged_file(path, rows);
+}
+
+}  // namespace fims
+
+#endif /* FIMS_RAGGED_FILE_HPP */
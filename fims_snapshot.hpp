@@ -0,0 +1,342 @@
+/*! \file fims_snapshot.hpp
+ */
+
+/*
+ * File:   fims_snapshot.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * Checkpoint snapshots of an evaluated population: calendar, partition
+ * layout, per partition state and the derived-quantity buffer. Snapshots
+ * are written to a temporary file and renamed into place, optionally on a
+ * background thread, and reloaded by mapping the file, so the derived
+ * quantities are used in place and paged in on demand.
+ *
+ * File layout, all values as written by the host:
+ *
+ *   char[8]  magic "FIMSSN01"
+ *   uint64   header[10]  nyears, nages, layout, nreplicates, ndims,
+ *                        npartitions, partition_size, partition_stride,
+ *                        nseason_offsets, nage_classes
+ *   uint64   nseasons[nyears]
+ *   double   season_offsets[nseason_offsets]
+ *   double   ages[nage_classes]
+ *   uint64   dims[ndims]
+ *   uint64   area_index[npartitions]
+ *   uint64   dirty_year[npartitions]
+ *   double   replicate_parameters[nreplicates]
+ *   zero padding to a multiple of 64 bytes
+ *   double   values[npartitions * partition_stride]
+ *
+ */
+#ifndef FIMS_SNAPSHOT_HPP
+#define FIMS_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fims {
+
+/**
+ * @brief Owning copy of the state stored in a snapshot, in file order.
+ */
+struct snapshot_data {
+    uint64_t nyears = 0;
+    uint64_t nages = 0;
+    uint64_t layout = 0; //index_layout as an integer
+    uint64_t nreplicates = 1;
+    uint64_t partition_size = 0;
+    uint64_t partition_stride = 0;
+    std::vector<uint64_t> nseasons;
+    std::vector<double> season_offsets;
+    std::vector<double> ages;
+    std::vector<uint64_t> dims;
+    std::vector<uint64_t> area_index;
+    std::vector<uint64_t> dirty_year;
+    std::vector<double> replicate_parameters;
+    std::vector<double> values;
+};
+
+/**
+ * @brief Non-owning view of a snapshot, as mapped from a file.
+ */
+struct snapshot_view {
+    uint64_t nyears;
+    uint64_t nages;
+    uint64_t layout;
+    uint64_t nreplicates;
+    uint64_t ndims;
+    uint64_t npartitions;
+    uint64_t partition_size;
+    uint64_t partition_stride;
+    uint64_t nseason_offsets;
+    uint64_t nage_classes;
+    const uint64_t* nseasons;
+    const double* season_offsets;
+    const double* ages;
+    const uint64_t* dims;
+    const uint64_t* area_index;
+    const uint64_t* dirty_year;
+    const double* replicate_parameters;
+    double* values; //private copy-on-write pages, see mapped_snapshot
+};
+
+namespace detail {
+
+const size_t snapshot_header_bytes = 8 + 10 * 8;
+
+//bytes before the values, padded so they start on a cache line
+inline size_t snapshot_prefix_bytes(uint64_t nyears, uint64_t nseason_offsets,
+        uint64_t nage_classes, uint64_t ndims, uint64_t npartitions,
+        uint64_t nreplicates) {
+    size_t bytes = snapshot_header_bytes + 8 * (nyears + nseason_offsets +
+            nage_classes + ndims + 2 * npartitions + nreplicates);
+    return (bytes + 63) / 64 * 64;
+}
+
+}  // namespace detail
+
+/**
+ * @brief Write a snapshot to path. The file is written as path + ".tmp"
+ * and renamed, so a reader never sees a partial snapshot.
+ *
+ * @param path
+ * @param data
+ */
+inline void write_snapshot(const std::string& path, const snapshot_data& data) {
+    const uint64_t npartitions = data.area_index.size();
+    if (data.dirty_year.size() != npartitions || data.nseasons.size() != data.nyears ||
+            data.replicate_parameters.size() != data.nreplicates ||
+            data.values.size() != npartitions * data.partition_stride) {
+        throw std::invalid_argument("write_snapshot: inconsistent snapshot_data for " + path);
+    }
+    const uint64_t header[10] = {data.nyears, data.nages, data.layout, data.nreplicates,
+        data.dims.size(), npartitions, data.partition_size, data.partition_stride,
+        data.season_offsets.size(), data.ages.size()};
+    const size_t prefix = detail::snapshot_prefix_bytes(data.nyears, data.season_offsets.size(),
+            data.ages.size(), data.dims.size(), npartitions, data.nreplicates);
+    const size_t used = detail::snapshot_header_bytes + 8 * (data.nyears +
+            data.season_offsets.size() + data.ages.size() + data.dims.size() +
+            2 * npartitions + data.nreplicates);
+    const char padding[64] = {0};
+
+    const std::string tmp = path + ".tmp";
+    std::FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (file == NULL) {
+        throw std::runtime_error("write_snapshot: unable to open " + tmp);
+    }
+    bool ok = std::fwrite("FIMSSN01", 1, 8, file) == 8;
+    ok = ok && std::fwrite(header, 8, 10, file) == 10;
+    ok = ok && std::fwrite(data.nseasons.data(), 8, data.nseasons.size(), file) == data.nseasons.size();
+    ok = ok && std::fwrite(data.season_offsets.data(), 8, data.season_offsets.size(), file) == data.season_offsets.size();
+    ok = ok && std::fwrite(data.ages.data(), 8, data.ages.size(), file) == data.ages.size();
+    ok = ok && std::fwrite(data.dims.data(), 8, data.dims.size(), file) == data.dims.size();
+    ok = ok && std::fwrite(data.area_index.data(), 8, npartitions, file) == npartitions;
+    ok = ok && std::fwrite(data.dirty_year.data(), 8, npartitions, file) == npartitions;
+    ok = ok && std::fwrite(data.replicate_parameters.data(), 8, data.nreplicates, file) == data.nreplicates;
+    ok = ok && std::fwrite(padding, 1, prefix - used, file) == prefix - used;
+    ok = ok && std::fwrite(data.values.data(), 8, data.values.size(), file) == data.values.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("write_snapshot: write failed for " + path);
+    }
+}
+
+/**
+ * @brief Writes snapshots on a background thread, one at a time.
+ *
+ * start() takes ownership of the data, so the caller may keep evaluating
+ * while the file is written. wait() blocks until the current write has
+ * finished and rethrows its error, if any.
+ */
+class async_snapshot_writer {
+    std::thread thread_;
+    std::exception_ptr error_;
+
+public:
+
+    async_snapshot_writer() {
+    }
+
+    async_snapshot_writer(const async_snapshot_writer&) = delete;
+    async_snapshot_writer& operator=(const async_snapshot_writer&) = delete;
+
+    /**
+     * @brief Waits for the last write, errors are discarded.
+     */
+    ~async_snapshot_writer() {
+        if (this->thread_.joinable()) {
+            this->thread_.join();
+        }
+    }
+
+    /**
+     * @brief Start writing data to path, after waiting for the previous
+     * write.
+     *
+     * @param path
+     * @param data
+     */
+    void start(const std::string& path, snapshot_data data) {
+        this->wait();
+        this->thread_ = std::thread([this, path](snapshot_data d) {
+            try {
+                write_snapshot(path, d);
+            } catch (...) {
+                this->error_ = std::current_exception();
+            }
+        }, std::move(data));
+    }
+
+    /**
+     * @brief Wait for the current write and rethrow its error.
+     */
+    void wait() {
+        if (this->thread_.joinable()) {
+            this->thread_.join();
+        }
+        if (this->error_) {
+            std::exception_ptr error = this->error_;
+            this->error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    inline bool busy() const {
+        return this->thread_.joinable();
+    }
+};
+
+/**
+ * @brief Memory mapping of a snapshot file.
+ *
+ * The file is mapped privately and writable: pages are read on first
+ * access and copied on first write, so a restored population evaluates in
+ * place without changing the file, and processes restoring the same
+ * snapshot share the pages they do not modify. Only the sizes are
+ * validated on open, nothing is read eagerly. The view is valid for the
+ * lifetime of this object.
+ */
+class mapped_snapshot {
+    void* map_;
+    size_t length_;
+    snapshot_view view_;
+
+    void fail(const std::string& path, const char* what) {
+        if (this->map_ != MAP_FAILED) {
+            munmap(this->map_, this->length_);
+        }
+        throw std::runtime_error("mapped_snapshot: " + path + ": " + what);
+    }
+
+public:
+
+    explicit mapped_snapshot(const std::string& path) : map_(MAP_FAILED), length_(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fail(path, "unable to open");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            fail(path, "unable to stat");
+        }
+        this->length_ = static_cast<size_t> (st.st_size);
+        if (this->length_ < detail::snapshot_header_bytes) {
+            close(fd);
+            fail(path, "truncated header");
+        }
+        this->map_ = mmap(NULL, this->length_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (this->map_ == MAP_FAILED) {
+            fail(path, "mmap failed");
+        }
+
+        char* p = static_cast<char*> (this->map_);
+        if (std::memcmp(p, "FIMSSN01", 8) != 0) {
+            fail(path, "bad magic");
+        }
+        uint64_t header[10];
+        std::memcpy(header, p + 8, sizeof (header));
+        snapshot_view& v = this->view_;
+        v.nyears = header[0];
+        v.nages = header[1];
+        v.layout = header[2];
+        v.nreplicates = header[3];
+        v.ndims = header[4];
+        v.npartitions = header[5];
+        v.partition_size = header[6];
+        v.partition_stride = header[7];
+        v.nseason_offsets = header[8];
+        v.nage_classes = header[9];
+
+        //compare in units of elements so corrupt sizes cannot overflow
+        const uint64_t words = this->length_ / 8;
+        const uint64_t counts[] = {v.nyears, v.nseason_offsets, v.nage_classes, v.ndims,
+            v.npartitions, v.npartitions, v.nreplicates};
+        uint64_t total = 0;
+        for (size_t i = 0; i < sizeof (counts) / sizeof (counts[0]); i++) {
+            if (counts[i] > words || total > words - counts[i]) {
+                fail(path, "size mismatch");
+            }
+            total += counts[i];
+        }
+        if (v.partition_stride < v.partition_size ||
+                (v.npartitions > 0 && v.partition_stride > words / v.npartitions)) {
+            fail(path, "size mismatch");
+        }
+        const size_t prefix = detail::snapshot_prefix_bytes(v.nyears, v.nseason_offsets,
+                v.nage_classes, v.ndims, v.npartitions, v.nreplicates);
+        if (prefix / 8 > words || v.npartitions * v.partition_stride != words - prefix / 8 ||
+                this->length_ % 8 != 0) {
+            fail(path, "size mismatch");
+        }
+
+        const char* q = p + detail::snapshot_header_bytes;
+        v.nseasons = reinterpret_cast<const uint64_t*> (q);
+        q += 8 * v.nyears;
+        v.season_offsets = reinterpret_cast<const double*> (q);
+        q += 8 * v.nseason_offsets;
+        v.ages = reinterpret_cast<const double*> (q);
+        q += 8 * v.nage_classes;
+        v.dims = reinterpret_cast<const uint64_t*> (q);
+        q += 8 * v.ndims;
+        v.area_index = reinterpret_cast<const uint64_t*> (q);
+        q += 8 * v.npartitions;
+        v.dirty_year = reinterpret_cast<const uint64_t*> (q);
+        q += 8 * v.npartitions;
+        v.replicate_parameters = reinterpret_cast<const double*> (q);
+        v.values = reinterpret_cast<double*> (p + prefix);
+    }
+
+    mapped_snapshot(const mapped_snapshot&) = delete;
+    mapped_snapshot& operator=(const mapped_snapshot&) = delete;
+
+    ~mapped_snapshot() {
+        munmap(this->map_, this->length_);
+    }
+
+    inline const snapshot_view& view() const {
+        return this->view_;
+    }
+};
+
+}  // namespace fims
+
+#endif /* FIMS_SNAPSHOT_HPP */
@@ -0,0 +1,420 @@
+/*! \file fims_thread_pool.hpp
+ */
+
+/*
+ * File:   fims_thread_pool.hpp
+ *
+ * This File is part of the NOAA, National Marine Fisheries Service
+ * Fisheries Integrated Modeling System project. See LICENSE in the
+ * source folder for reuse information.
+ *
+ * A small persistent thread pool used to evaluate independent model
+ * partitions concurrently. Worker threads are created once and parked on a
+ * condition variable between calls, so the pool can be used repeatedly
+ * inside an optimizer loop.
+ *
+ */
+#ifndef FIMS_THREAD_POOL_HPP
+#define FIMS_THREAD_POOL_HPP
+
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef FIMS_NUMA
+#include <numa.h>
+#endif
+
+namespace fims {
+
+/**
+ * @brief Persistent fork/join thread pool.
+ *
+ * parallel_for(n, f) calls f(i) exactly once for every i in [0, n) and
+ * returns when all calls have finished. The calling thread takes part in
+ * the work, so a pool of size n uses n - 1 worker threads. Indices are
+ * handed out dynamically; results are deterministic as long as each f(i)
+ * only writes to data owned by index i.
+ *
+ * run_on_each(f) calls f(t) once on every thread t of the pool, the caller
+ * being thread 0. Together with pin_threads it gives work a fixed home
+ * thread and CPU, e.g. for first-touch NUMA placement.
+ *
+ * parallel_for and run_on_each are not reentrant: they must not be called
+ * from inside a task or from two threads at the same time.
+ */
+class thread_pool {
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    size_t generation_; //incremented once per parallel_for call
+    size_t busy_; //workers still running the current call
+    bool stop_;
+
+    //current task, type erased without allocation
+    void (*fn_)(void*, size_t);
+    void* ctx_;
+    size_t n_;
+    bool per_thread_; //run_on_each, one call per thread with the thread's index
+    std::atomic<size_t> next_;
+    std::exception_ptr error_;
+
+#ifdef __linux__
+    //affinity of the thread that called pin_threads, before it was pinned
+    bool caller_pinned_;
+    pthread_t caller_;
+    cpu_set_t caller_mask_;
+#endif
+
+    template <class F>
+    static void invoke(void* ctx, size_t i) {
+        (*static_cast<F*> (ctx))(i);
+    }
+
+    void run_task(size_t i) {
+        try {
+            this->fn_(this->ctx_, i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (!this->error_) {
+                this->error_ = std::current_exception();
+            }
+        }
+    }
+
+    void run_tasks() {
+        size_t i;
+        while ((i = this->next_.fetch_add(1)) < this->n_) {
+            this->run_task(i);
+        }
+    }
+
+    void worker_loop(size_t index) {
+        size_t seen = 0;
+        for (;;) {
+            bool per_thread;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->work_cv_.wait(lock, [&] {
+                    return this->stop_ || this->generation_ != seen;
+                });
+                if (this->stop_) {
+                    return;
+                }
+                seen = this->generation_;
+                per_thread = this->per_thread_;
+            }
+
+            if (per_thread) {
+                this->run_task(index);
+            } else {
+                this->run_tasks();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                if (--this->busy_ == 0) {
+                    this->done_cv_.notify_one();
+                }
+            }
+        }
+    }
+
+public:
+
+    /**
+     * @brief Create a pool that runs tasks on nthreads threads, including
+     * the caller. nthreads of 0 or 1 runs everything serially.
+     *
+     * @param nthreads
+     */
+    explicit thread_pool(size_t nthreads) : generation_(0), busy_(0),
+    stop_(false), fn_(nullptr), ctx_(nullptr), n_(0), per_thread_(false), next_(0) {
+#ifdef __linux__
+        this->caller_pinned_ = false;
+#endif
+        for (size_t i = 1; i < nthreads; i++) {
+            this->workers_.emplace_back(&thread_pool::worker_loop, this, i);
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * @brief Joins the workers and restores the affinity of the thread
+     * pinned by pin_threads, see unpin_caller.
+     */
+    ~thread_pool() {
+        this->unpin_caller();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->stop_ = true;
+        }
+        this->work_cv_.notify_all();
+        for (size_t i = 0; i < this->workers_.size(); i++) {
+            this->workers_[i].join();
+        }
+    }
+
+    /**
+     * @brief Number of threads used by parallel_for, including the caller.
+     */
+    inline size_t size() const {
+        return this->workers_.size() + 1;
+    }
+
+    /**
+     * @brief Call f(i) for every i in [0, n) and wait for completion. The
+     * first exception thrown by a task is rethrown here.
+     *
+     * @param n number of tasks
+     * @param f callable taking a size_t task index
+     */
+    template <class F>
+    void parallel_for(size_t n, F&& f) {
+        if (this->workers_.empty() || n <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                f(i);
+            }
+            return;
+        }
+        this->dispatch(n, f, false);
+    }
+
+    /**
+     * @brief Call f(t) on thread t for every t in [0, size()) and wait for
+     * completion. The caller runs t = 0. The first exception thrown by a
+     * task is rethrown here.
+     *
+     * @param f callable taking a size_t thread index
+     */
+    template <class F>
+    void run_on_each(F&& f) {
+        if (this->workers_.empty()) {
+            f(0);
+            return;
+        }
+        this->dispatch(this->size(), f, true);
+    }
+
+    /**
+     * @brief Pin thread t to cpus[t % cpus.size()]. Thread 0 is the calling
+     * thread, which should be the one that later calls parallel_for and
+     * run_on_each. Its previous affinity is saved and restored by
+     * unpin_caller or when the pool is destroyed, which must happen before
+     * that thread exits. Returns false when pinning is not supported
+     * (outside Linux) or any thread could not be pinned.
+     *
+     * @param cpus CPU ids
+     * @return
+     */
+    bool pin_threads(const std::vector<int>& cpus) {
+        if (cpus.empty()) {
+            return false;
+        }
+#ifdef __linux__
+        this->unpin_caller();
+        this->caller_ = pthread_self();
+        this->caller_pinned_ = pthread_getaffinity_np(this->caller_,
+                sizeof (this->caller_mask_), &this->caller_mask_) == 0;
+        bool ret = pin(this->caller_, cpus[0]);
+        for (size_t t = 1; t < this->size(); t++) {
+            ret = pin(this->workers_[t - 1].native_handle(), cpus[t % cpus.size()]) && ret;
+        }
+        return ret;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Give the thread pinned as thread 0 by pin_threads its previous
+     * affinity back. Workers stay pinned. Does nothing when pin_threads was
+     * not called.
+     */
+    void unpin_caller() {
+#ifdef __linux__
+        if (this->caller_pinned_) {
+            pthread_setaffinity_np(this->caller_, sizeof (this->caller_mask_), &this->caller_mask_);
+            this->caller_pinned_ = false;
+        }
+#endif
+    }
+
+    /**
+     * @brief NUMA node of a CPU, 0 when it cannot be determined. Uses
+     * libnuma when built with FIMS_NUMA, sysfs otherwise.
+     *
+     * @param cpu
+     * @return
+     */
+    static int node_of_cpu(int cpu) {
+#if defined(FIMS_NUMA)
+        int node = numa_available() < 0 ? -1 : numa_node_of_cpu(cpu);
+        return node < 0 ? 0 : node;
+#elif defined(__linux__)
+        char path[64];
+        std::snprintf(path, sizeof (path), "/sys/devices/system/cpu/cpu%d", cpu);
+        int ret = 0;
+        DIR* dir = opendir(path);
+        if (dir != NULL) {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (std::strncmp(entry->d_name, "node", 4) == 0 &&
+                        std::isdigit(static_cast<unsigned char> (entry->d_name[4]))) {
+                    ret = std::atoi(entry->d_name + 4);
+                    break;
+                }
+            }
+            closedir(dir);
+        }
+        return ret;
+#else
+        (void) cpu;
+        return 0;
+#endif
+    }
+
+private:
+
+#ifdef __linux__
+
+    static bool pin(pthread_t thread, int cpu) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread, sizeof (set), &set) == 0;
+    }
+#endif
+
+    template <class F>
+    void dispatch(size_t n, F& f, bool per_thread) {
+        typedef typename std::remove_reference<F>::type functor;
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->fn_ = &thread_pool::invoke<functor>;
+            this->ctx_ = const_cast<void*> (static_cast<const void*> (&f));
+            this->n_ = n;
+            this->per_thread_ = per_thread;
+            this->next_.store(0);
+            this->error_ = nullptr;
+            this->busy_ = this->workers_.size();
+            this->generation_++;
+        }
+        this->work_cv_.notify_all();
+
+        if (per_thread) {
+            this->run_task(0);
+        } else {
+            this->run_tasks();
+        }
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->done_cv_.wait(lock, [&] {
+                return this->busy_ == 0;
+            });
+            error = this->error_;
+            this->error_ = nullptr;
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+namespace detail {
+
+//sums partials[first, last) as a balanced binary tree, split by index only
+template <class T>
+T tree_sum(const T* partials, size_t first, size_t last) {
+    if (last - first == 1) {
+        return partials[first];
+    }
+    size_t mid = first + (last - first) / 2;
+    return tree_sum(partials, first, mid) + tree_sum(partials, mid, last);
+}
+
+}  // namespace detail
+
+/**
+ * @brief Deterministic parallel reduction over [0, n).
+ *
+ * The range is cut into blocks of block_size, independent of the number of
+ * threads, f(begin, end) returns the partial of block [begin, end), and
+ * the partials are combined as a fixed binary tree in block order. The
+ * result is therefore bit for bit the same for any pool size and any
+ * scheduling. f may be any block reduction, e.g. a negative
+ * log-likelihood total:
+ *
+ *   parallel_reduce<double>(pool, n, 16384, [&](size_t b, size_t e) {
+ *       return fims::dnorm_nll(x + b, mean + b, sd, e - b);
+ *   });
+ *
+ * @param pool
+ * @param n number of elements
+ * @param block_size elements per block, at least 1
+ * @param f callable taking (begin, end) and returning a T
+ * @return the total, T(0) if n is 0
+ */
+template <class T, class F>
+T parallel_reduce(thread_pool& pool, size_t n, size_t block_size, F f) {
+    if (n == 0) {
+        return T(0.0);
+    }
+    if (block_size == 0) {
+        block_size = 1;
+    }
+    size_t nblocks = (n + block_size - 1) / block_size;
+    std::vector<T> partials(nblocks);
+    pool.parallel_for(nblocks, [&](size_t b) {
+        size_t begin = b * block_size;
+        size_t end = begin + block_size < n ? begin + block_size : n;
+        partials[b] = f(begin, end);
+    });
+    return detail::tree_sum(partials.data(), 0, nblocks);
+}
+
+/**
+ * @brief Deterministic parallel sum of n values, each block reduced with
+ * Policy::reduce (fims::ordered_summation, fims::kahan_summation or
+ * fims::pairwise_summation from fims_math.hpp).
+ *
+ * @param pool
+ * @param x pointer to the n values
+ * @param n number of values
+ * @param block_size values per block
+ * @return
+ */
+template <class Policy, class T>
+T parallel_sum(thread_pool& pool, const T* x, size_t n, size_t block_size = 16384) {
+    return parallel_reduce<T>(pool, n, block_size, [x](size_t begin, size_t end) {
+        return Policy::reduce(x + begin, end - begin);
+    });
+}
+
+}  // namespace fims
+
+#endif /* FIMS_THREAD_POOL_HPP */
@@ -1,11 +1,72 @@
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <vector>
 #include <map>
+#include <memory>
 #include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "fims_ragged_file.hpp"
 
 using namespace std;
 
+/**
+ * Number of grid points first_age + k / steps_per_age below last_age.
+ * Computed directly and corrected for rounding, so the count does not
+ * depend on accumulated increments.
+ */
+size_t age_grid_points(double first_age, double last_age, uint32_t steps_per_age) {
+    if (!(last_age > first_age)) {
+        return 0;
+    }
+    size_t n = static_cast<size_t> (std::ceil((last_age - first_age) * steps_per_age));
+    while (n > 0 && first_age + (n - 1) / static_cast<double> (steps_per_age) >= last_age) {
+        n--;
+    }
+    while (first_age + n / static_cast<double> (steps_per_age) < last_age) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Fill grid with first_age + k / steps_per_age, k = 0 .. n - 1. Each point
+ * is computed from its index, so there is no floating point drift.
+ */
+void fill_age_grid(double first_age, uint32_t steps_per_age, double* grid, size_t n) {
+    const double steps = static_cast<double> (steps_per_age);
+    for (size_t k = 0; k < n; k++) {
+        grid[k] = first_age + static_cast<double> (k) / steps;
+    }
+}
+
+/**
+ * Age grid for one year of data time snapshots: for every whole age a in
+ * [first_age, last_age), a, a + timestamps[j] for each timestamp, then
+ * last_age. The size is known up front and the grid is filled in one pass.
+ */
+std::vector<double> build_snapshot_age_grid(double first_age, double last_age,
+        const double* timestamps, size_t ntimestamps) {
+    const size_t nages = age_grid_points(first_age, last_age, 1);
+    const size_t stride = ntimestamps + 2;
+    std::vector<double> grid(nages * stride);
+    for (size_t i = 0; i < nages; i++) {
+        const double a = first_age + static_cast<double> (i);
+        double* row = grid.data() + i * stride;
+        row[0] = a;
+        for (size_t j = 0; j < ntimestamps; j++) {
+            row[j + 1] = a + timestamps[j];
+        }
+        row[ntimestamps + 1] = last_age;
+    }
+    return grid;
+}
+
 class TimeStepPrototype_1 {
     uint32_t nages;
     std::vector<double> ages;
@@ -22,18 +83,14 @@ public:
     TimeStepPrototype_1(uint32_t nyears, uint32_t nseasons, double first_age, double last_age) :
     nyears(nyears), nseasons(nseasons), first_age(first_age), last_age(last_age) {
 
-        double age_increment = 1.0 / nseasons;
-        double age = first_age;
-
-        while (age < last_age) {
-            this->ages.push_back(age);
-            age += age_increment;
-        }
-
+        this->ages.resize(age_grid_points(first_age, last_age, nseasons));
+        fill_age_grid(first_age, nseasons, this->ages.data(), this->ages.size());
+    }
 
-        for (int i = 0; i < this->nyears; i++) {
+    void print() const {
+        for (uint32_t i = 0; i < this->nyears; i++) {
             std::cout << "year " << i << ":\n";
-            for (int a = 0; a < this->ages.size(); a++) {
+            for (size_t a = 0; a < this->ages.size(); a++) {
                 std::cout << this->ages[a] << " ";
             }
             std::cout << std::endl;
@@ -45,7 +102,8 @@ public:
 class TimeStepPrototype_2 {
     uint32_t nages;
 
-    std::map<uint32_t, std::vector<double> > ages;
+    //age grid by year, years with the same timestamps as the previous year share a grid
+    std::map<uint32_t, std::shared_ptr<const std::vector<double> > > ages;
 
 public:
 
@@ -55,43 +113,71 @@ public:
     double first_age;
     double last_age;
 
-    TimeStepPrototype_2(std::map<uint32_t, std::vector<double> > data_time_snapshot, 
+    TimeStepPrototype_2(const std::map<uint32_t, std::vector<double> >& data_time_snapshot,
     double first_age, double last_age) :
     first_age(first_age), last_age(last_age) {
 
         this->nyears = data_time_snapshot.size();
-        std::map<uint32_t, std::vector<double> >::iterator it;
+        std::map<uint32_t, std::vector<double> >::const_iterator it;
 
+        //timestamps of the previous year, only used while building
+        const double* previous = NULL;
+        size_t nprevious = 0;
         for (it = data_time_snapshot.begin(); it != data_time_snapshot.end(); ++it) {
+            const std::vector<double>& timestamps = (*it).second;
+            this->add_year((*it).first, timestamps.data(), timestamps.size(), previous, nprevious);
+            previous = timestamps.data();
+            nprevious = timestamps.size();
+        }
+    }
 
-            std::vector<double>& timestamps = (*it).second;
-            uint32_t year = (*it).first;
-            std::vector<double> ages;
-            for (double a = first_age; a < last_age; a++) {
-                ages.push_back(a);
-                for (int j = 0; j < timestamps.size(); j++) {
-                    ages.push_back(a + timestamps[j]);
-                }
-                ages.push_back(last_age);
-                this->ages[year] = ages;
-            }
+    /**
+     * Construct from a ragged view of timestamps, row i holding year i,
+     * e.g. a memory-mapped file from fims::write_ragged_file.
+     */
+    TimeStepPrototype_2(const fims::ragged_view& data_time_snapshot,
+    double first_age, double last_age) :
+    first_age(first_age), last_age(last_age) {
 
+        this->nyears = data_time_snapshot.size();
+        for (uint32_t year = 0; year < this->nyears; year++) {
+            const double* previous = year > 0 ? data_time_snapshot.row(year - 1) : NULL;
+            size_t nprevious = year > 0 ? data_time_snapshot.row_size(year - 1) : 0;
+            this->add_year(year, data_time_snapshot.row(year), data_time_snapshot.row_size(year),
+                    previous, nprevious);
         }
+    }
 
-        std::map<uint32_t, std::vector<double> >::iterator ages_iterator;
+    void print() const {
+        std::map<uint32_t, std::shared_ptr<const std::vector<double> > >::const_iterator ages_iterator;
         for (ages_iterator = this->ages.begin(); ages_iterator != this->ages.end(); ++ages_iterator) {
             uint32_t year = (*ages_iterator).first;
             std::cout << "year " << year << ":\n";
-            std::vector<double>& ages = (*ages_iterator).second;
-            for (double a = 0; a < ages.size(); a++) {
+            const std::vector<double>& ages = *(*ages_iterator).second;
+            for (size_t a = 0; a < ages.size(); a++) {
                 std::cout << ages[a] << " ";
             }
             std::cout << std::endl;
         }
+    }
 
-
-
-
+private:
+
+    /**
+     * Add the age grid of one year, shared with the previous year when its
+     * timestamps are the same.
+     */
+    void add_year(uint32_t year, const double* timestamps, size_t ntimestamps,
+            const double* previous, size_t nprevious) {
+        std::shared_ptr<const std::vector<double> > grid;
+        if (!this->ages.empty() && ntimestamps == nprevious &&
+                std::equal(timestamps, timestamps + ntimestamps, previous)) {
+            grid = this->ages.rbegin()->second;
+        } else {
+            grid = std::make_shared<const std::vector<double> >(
+                    build_snapshot_age_grid(first_age, last_age, timestamps, ntimestamps));
+        }
+        this->ages[year] = grid;
     }
 
 
@@ -127,12 +213,29 @@ int main(int argc, char** argv) {
 
     std::cout << "EXAMPLE 1\n\n";
     TimeStepPrototype_1 example1(7, 3, 1, 7);
+    example1.print();
     TimeStepPrototype_2 example1_2(data_driven_timestamps1, 1, 7);
+    example1_2.print();
 
 
     std::cout << "\n\nEXAMPLE 2\n\n";
     TimeStepPrototype_1 example2(7, 3, 1, 7);
+    example2.print();
     TimeStepPrototype_2 example2_2(data_driven_timestamps2, 1, 7);
+    example2_2.print();
+
+
+    std::cout << "\n\nEXAMPLE 3, memory-mapped timestamps\n\n";
+    //a scratch file private to this run, removed once it is unmapped
+    std::string timestamps_path = "/tmp/data_driven_timestamps2." +
+            std::to_string(static_cast<long> (getpid())) + ".bin";
+    fims::write_ragged_file(timestamps_path, data_driven_timestamps2);
+    {
+        fims::mapped_ragged_file mapped_timestamps(timestamps_path);
+        TimeStepPrototype_2 example3_2(mapped_timestamps.view(), 1, 7);
+        example3_2.print();
+    }
+    std::remove(timestamps_path.c_str());
 
 
     return 0;